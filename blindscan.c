@@ -1,29 +1,602 @@
 // SPDX-License-Identifier: MIT
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <linux/dvb/frontend.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+#define READY_POLL_MS 10
+#define READY_TIMEOUT_MS 5000
+#define STATUS_POLL_MIN_MS 10
+#define STATUS_POLL_MAX_MS 500
+#define STATUS_POLL_DEFAULT_MS 100
+#define STATUS_SPURIOUS_MAX 3
+#define BULK_MAX 32
+#define VERIFY_TIMEOUT_MS 1000
+#define VERIFY_POLL_MS 10
+#define VERIFY_STATS_MS 200
+#define DISEQC_SETTLE_MS 15
+#define LNB_SETTLE_MS 15
+#define LNB_USER_BANDS_MAX 32
+#define SCR_WIDTH_MHZ 40
+#define SCR_STEP_MIN_MHZ 12
+#define PRESCAN_DEFAULT_MHZ 10
+#define PRESCAN_SYMBOL_RATE 30000000
+#define PRESCAN_DWELL_MS 5
+#define PRESCAN_SETTLE_MS 50
+#define OUTPUT_RING_SIZE (1 << 20)
+#define OUTPUT_BATCH (64 << 10)
+#define OUTPUT_FLUSH_MS 100
+#define CHECKPOINT_INTERVAL_MS 5000
+#define DISEQC_MOVE_MS 20000
+#define DAEMON_POLL_MS 500
+#define NIM_SLOTS_MAX 32
+#define PROGRESS_DEFAULT_MS 1000
+#define HIST_BUCKETS 24
+#define MOCK_STEP_MHZ 50
+#define MOCK_SLOTS 4
+
+enum
+{
+    BAND_LOW,
+    BAND_HIGH,
+    BAND_CBAND,
+};
+
+enum
+{
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_BINARY,
+};
+
+enum
+{
+    STAT_CTRL_POLL,
+    STAT_INFO_WRITE,
+    STAT_INFO_READ,
+    STAT_FORMAT,
+    STAT_SCAN,
+    STAT_PRESCAN,
+    STAT_MAX,
+};
+
+enum
+{
+    BULK_UNKNOWN,
+    BULK_YES,
+    BULK_NO,
+};
+
 static uint32_t start_frequency_mhz = 950;
 static uint32_t stop_frequency_mhz = 1950;
 static uint32_t symbolrate_min_mhz = 2;
 static uint32_t symbolrate_max_mhz = 45;
+static bool symbolrate_max_set;
 static bool vertical;
 static bool cband;
 static bool high;
 static int slot;
 static int i2c;
+static int settle_ms;
+static bool external_lnb;
+static bool range_set;
+static uint32_t prescan_mhz;
+static const char *output_path;
+static bool output_line;
+static FILE *output;
+static int slots[NIM_SLOTS_MAX];
+static int num_slots;
+static bool all_slots;
+static bool tag_slots;
+static bool stream;
+static const char *plan;
+static const char *campaign;
+static uint32_t split_mhz;
+static uint32_t symbolrate_split_mhz;
+static const char *cache_dir;
+static bool incremental;
+static const char *checkpoint_path;
+static bool resume;
+static bool merge;
+static int verify_slot = -1;
+static int format = FORMAT_TEXT;
+static const char *daemon_path;
+static int progress_ms;
+static bool stats_enabled;
+static const char *stats_path;
+static const struct bs_backend *backend;
+static const char *mock_source;
+static int mock_records;
+static int mock_latency_us;
+static bool mock_replay;
+static int mock_i2c_buses;
+static int bench_tuners;
+static const char *record_path;
+static FILE *record_fp;
+
+struct bs_session
+{
+    const struct bs_backend *backend;
+    void *priv;
+    int fe_id;
+    int slot;
+    int lock_fd;
+    int ctrl_fd;
+    int info_fd;
+    bool ctrl_pollable;
+    int ctrl_spurious;
+    int info_bulk;
+    uint64_t syscalls;
+    uint64_t io_us;
+    uint64_t io_calls;
+    uint64_t swept_mhz;
+    uint64_t transponders;
+    int dvb_fd;
+    bool lnb_valid;
+    int lnb_diseqc;
+    bool lnb_vertical;
+    int lnb_band;
+    int user_band;
+    uint32_t if_base_khz;
+    struct checkpoint *checkpoint;
+};
+
+/* Access to the driver's bs_ctrl and bs_info nodes of one frontend. */
+struct bs_backend
+{
+    int (*open)(struct bs_session *session);
+    void (*close)(struct bs_session *session);
+    ssize_t (*ctrl_read)(struct bs_session *session, char *buf, size_t count);
+    ssize_t (*ctrl_write)(struct bs_session *session, const char *buf, size_t count);
+    ssize_t (*info_read)(struct bs_session *session, char *buf, size_t count);
+    ssize_t (*info_write)(struct bs_session *session, const char *buf, size_t count);
+    bool (*wait)(struct bs_session *session, int timeout_ms);
+    bool (*power)(struct bs_session *session, uint32_t if_mhz, int64_t *level);
+};
+
+struct bs_result
+{
+    int index;
+    uint32_t frequency;
+    uint32_t symbol_rate;
+    int delivery_system;
+    int inversion;
+    int pilot;
+    int fec_inner;
+    int modulation;
+    int rolloff;
+    int pls_mode;
+    int is_id;
+    int pls_code;
+    int t2mi_plp_id;
+    int t2mi_pid;
+};
+
+struct bs_status
+{
+    int status;
+    int num_info;
+    int progress;
+};
+
+/* A decimal field of a driver line and the 32 bit member it is stored in. */
+struct bs_field
+{
+    const char *name;
+    size_t offset;
+    int64_t min;
+    int64_t max;
+};
+
+#define BS_FIELD(type, member, min, max) {#member, offsetof(struct type, member), min, max}
+
+/* Fixed layout record written by --format=binary, in host byte order. */
+struct bs_record
+{
+    uint16_t length;
+    uint16_t version;
+    int16_t slot;
+    uint8_t vertical;
+    uint8_t band;
+    uint16_t diseqc;
+    uint32_t frequency;
+    uint32_t lnb_frequency;
+    uint32_t symbol_rate;
+    int32_t delivery_system;
+    int32_t inversion;
+    int32_t pilot;
+    int32_t fec_inner;
+    int32_t modulation;
+    int32_t rolloff;
+    int32_t pls_mode;
+    int32_t is_id;
+    int32_t pls_code;
+    int32_t t2mi_plp_id;
+    int32_t t2mi_pid;
+} __attribute__((packed));
+
+#define BS_RECORD_VERSION 2
+
+enum
+{
+    LNB_UNIVERSAL,
+    LNB_CBAND,
+    LNB_CUSTOM,
+    LNB_WIDEBAND,
+    LNB_UNICABLE,
+    LNB_JESS,
+};
+
+/*
+ * Local oscillators of the LNB in kHz. Unicable (EN 50494) and JESS
+ * (EN 50607) routers translate a slice of the universal LNB's spectrum to
+ * one of their user bands, each of which can serve a tuner of its own.
+ */
+struct lnb_model
+{
+    int type;
+    uint32_t lo_low_khz;
+    uint32_t lo_high_khz;
+    uint32_t lo_cband_khz;
+    int num_user_bands;
+    int user_band[LNB_USER_BANDS_MAX];
+    uint32_t user_band_mhz[LNB_USER_BANDS_MAX];
+    uint32_t user_band_width_mhz[LNB_USER_BANDS_MAX];
+};
+
+enum
+{
+    DISEQC_NONE,
+    DISEQC_COMMITTED,
+    DISEQC_UNCOMMITTED,
+    DISEQC_POSITION,
+};
+
+/* A switch port or positioner position, DISEQC_NONE if the dish is fixed. */
+#define DISEQC(kind, port) ((kind) << 8 | (port))
+#define DISEQC_KIND(diseqc) ((diseqc) >> 8)
+#define DISEQC_PORT(diseqc) ((diseqc) & 0xff)
+
+struct scan_job
+{
+    int slot;
+    bool taken;
+    bool done;
+    FILE *out;
+    int diseqc;
+    bool vertical;
+    int band;
+    uint32_t start_frequency_mhz;
+    uint32_t stop_frequency_mhz;
+    uint32_t symbolrate_min_mhz;
+    uint32_t symbolrate_max_mhz;
+};
+
+struct name
+{
+    const char *s;
+    size_t len;
+};
+
+#define NAME(str) {str, sizeof(str) - 1}
+#define NAME_LOOKUP(table, val, dflt) name_lookup(table, sizeof(table) / sizeof(table[0]), val, dflt)
+
+static const struct name polarization_names[] = {
+    NAME("HORIZONTAL"),
+    NAME("VERTICAL"),
+};
+
+static const struct name band_names[] = {
+    [BAND_LOW] = NAME("low"),
+    [BAND_HIGH] = NAME("high"),
+    [BAND_CBAND] = NAME("cband"),
+};
+
+static const struct name lnb_names[] = {
+    [LNB_UNIVERSAL] = NAME("universal"),
+    [LNB_CBAND] = NAME("cband"),
+    [LNB_CUSTOM] = NAME("custom"),
+    [LNB_WIDEBAND] = NAME("wideband"),
+    [LNB_UNICABLE] = NAME("unicable"),
+    [LNB_JESS] = NAME("jess"),
+};
+
+static const struct name diseqc_names[] = {
+    [DISEQC_NONE] = NAME("none"),
+    [DISEQC_COMMITTED] = NAME("committed"),
+    [DISEQC_UNCOMMITTED] = NAME("uncommitted"),
+    [DISEQC_POSITION] = NAME("position"),
+};
+
+static const struct name diseqc_tags[] = {
+    [DISEQC_NONE] = NAME(" NONE_"),
+    [DISEQC_COMMITTED] = NAME(" COMMITTED_"),
+    [DISEQC_UNCOMMITTED] = NAME(" UNCOMMITTED_"),
+    [DISEQC_POSITION] = NAME(" POSITION_"),
+};
+
+static const struct name delivery_system_names[] = {
+    [SYS_DVBS] = NAME("DVB-S"),
+    [SYS_DVBS2] = NAME("DVB-S2"),
+};
+
+static const struct name inversion_names[] = {
+    [INVERSION_OFF] = NAME("INVERSION_OFF"),
+    [INVERSION_ON] = NAME("INVERSION_ON"),
+    [INVERSION_AUTO] = NAME("INVERSION_AUTO"),
+};
+
+static const struct name pilot_names[] = {
+    [PILOT_ON] = NAME("PILOT_ON"),
+    [PILOT_OFF] = NAME("PILOT_OFF"),
+    [PILOT_AUTO] = NAME("PILOT_AUTO"),
+};
+
+static const struct name fec_names[] = {
+    [FEC_1_2] = NAME("FEC_1_2"),
+    [FEC_2_3] = NAME("FEC_2_3"),
+    [FEC_3_4] = NAME("FEC_3_4"),
+    [FEC_4_5] = NAME("FEC_4_5"),
+    [FEC_5_6] = NAME("FEC_5_6"),
+    [FEC_6_7] = NAME("FEC_6_7"),
+    [FEC_7_8] = NAME("FEC_7_8"),
+    [FEC_8_9] = NAME("FEC_8_9"),
+    [FEC_AUTO] = NAME("FEC_AUTO"),
+    [FEC_3_5] = NAME("FEC_3_5"),
+    [FEC_9_10] = NAME("FEC_9_10"),
+    [FEC_2_5] = NAME("FEC_2_5"),
+};
+
+static const struct name modulation_names[] = {
+    [QPSK] = NAME("QPSK"),
+    [PSK_8] = NAME("8PSK"),
+    [APSK_16] = NAME("16APSK"),
+    [APSK_32] = NAME("32APSK"),
+};
+
+static const struct name rolloff_names[] = {
+    [ROLLOFF_35] = NAME("ROLLOFF_35"),
+    [ROLLOFF_20] = NAME("ROLLOFF_20"),
+    [ROLLOFF_25] = NAME("ROLLOFF_25"),
+};
+
+static const struct name *name_lookup(const struct name *table, size_t num, int val, int dflt)
+{
+    if (val >= 0 && (size_t)val < num && table[val].s)
+        return &table[val];
+
+    return &table[dflt];
+}
+
+struct nim_slot
+{
+    int slot;
+    int fe_id;
+    int i2c;
+    char type[32];
+    bool blindscan;
+};
+
+struct nim_topology
+{
+    struct nim_slot *slots;
+    int num;
+};
+
+struct mock_state
+{
+    int status;
+    int progress;
+    int num;
+    uint32_t start;
+    uint32_t stop;
+    int info_first;
+    int info_last;
+    int ctrl_pos;
+    int seg;
+    uint64_t replay_start_us;
+};
+
+/* Driver responses to one bs_ctrl scan command of a trace. */
+struct mock_segment
+{
+    uint64_t start_us;
+    char **ctrl;
+    uint64_t *ctrl_us;
+    int num_ctrl;
+    char **info;
+    int num_info;
+};
+
+struct mock_trace
+{
+    struct mock_segment *seg;
+    int num;
+};
+
+/* Latency histogram with power of two microsecond buckets. */
+struct histogram
+{
+    const char *name;
+    const char *help;
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+struct scan_thread
+{
+    pthread_t thread;
+    int slot;
+    int fe_id;
+    int i2c;
+    uint64_t elapsed_us;
+    struct bs_session session;
+};
+
+/*
+ * Records printed to --output are copied into a ring buffer and written
+ * out by a thread of their own in batches of up to two iovecs.
+ */
+struct output_ring
+{
+    int fd;
+    char *buf;
+    size_t head;
+    size_t len;
+    bool line;
+    bool closing;
+    bool failed;
+    uint64_t writes;
+    uint64_t bytes;
+    uint64_t stalls;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_cond_t space;
+};
+
+/* A frequency range in MHz of IF. */
+struct span
+{
+    uint32_t start_mhz;
+    uint32_t stop_mhz;
+};
+
+struct result_list
+{
+    struct bs_result *r;
+    int num;
+};
+
+/* A range in MHz of IF swept for a range of symbol rates. */
+struct sweep
+{
+    uint32_t start_mhz;
+    uint32_t stop_mhz;
+    uint32_t sr_min_mhz;
+    uint32_t sr_max_mhz;
+};
+
+/*
+ * Progress of a job kept in the --checkpoint file. Of the sweep in progress
+ * only partial.start_mhz...partial.stop_mhz is known to be complete, so the
+ * results it found from partial_first on above that are left out of the file.
+ */
+struct checkpoint
+{
+    struct scan_job job;
+    bool gaps;
+    bool complete;
+    struct sweep *done;
+    int num_done;
+    struct sweep partial;
+    int partial_first;
+    struct result_list found;
+};
+
+/* Lock state and signal quality measured by the verifying tuner. */
+struct bs_verify
+{
+    bool verified;
+    bool locked;
+    bool has_cnr;
+    bool has_ber;
+    int64_t cnr;
+    double ber;
+};
+
+struct verify_item
+{
+    int slot;
+    struct scan_job job;
+    struct bs_result r;
+};
+
+/* A transponder of the merge index with the job and slot that found it. */
+struct merged_result
+{
+    int slot;
+    int quality;
+    struct scan_job job;
+    struct bs_result r;
+};
+
+/* Results ordered by job slot, switch position, polarisation, band and frequency. */
+struct result_index
+{
+    struct merged_result *e;
+    int num;
+    int size;
+    uint32_t max_symbol_rate;
+};
+
+static struct scan_job **jobs;
+static int num_jobs;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+static struct histogram stats[STAT_MAX] = {
+    [STAT_CTRL_POLL] = {"ctrl_poll", "bs_ctrl status read latency"},
+    [STAT_INFO_WRITE] = {"info_write", "bs_info index write latency"},
+    [STAT_INFO_READ] = {"info_read", "bs_info record read latency"},
+    [STAT_FORMAT] = {"format", "result formatting and output latency"},
+    [STAT_SCAN] = {"scan", "driver scan duration per bs_ctrl command"},
+    [STAT_PRESCAN] = {"prescan", "spectrum pre-scan duration per job"},
+};
+static struct mock_trace mock_trace;
+static uint64_t stats_start_us;
+static uint64_t stats_syscalls_total;
+static uint64_t stats_switch_changes;
+static pthread_mutex_t mock_bus_lock[NIM_SLOTS_MAX];
+static uint64_t stats_first_result_us;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct lnb_model lnb = {
+    .type = LNB_UNIVERSAL,
+    .lo_low_khz = 9750000,
+    .lo_high_khz = 10600000,
+    .lo_cband_khz = 5150000,
+};
+static bool user_band_busy[LNB_USER_BANDS_MAX];
+static pthread_mutex_t lnb_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct result_index merged;
+static pthread_mutex_t merged_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct checkpoint **checkpoints;
+static int num_checkpoints;
+static uint64_t checkpoint_us;
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct verify_item **verify_queue;
+static int num_verify;
+static bool verify_running;
+static bool verify_finished;
+static pthread_t verify_thread;
+static int verify_lock_fd = -1;
+static int verify_fd = -1;
+static pthread_mutex_t verify_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t verify_cond = PTHREAD_COND_INITIALIZER;
 
 volatile sig_atomic_t signal_status;
 
@@ -45,8 +618,42 @@ static void print_usage(char **argv)
                     "  -V, --vertical          Signal polarity is vertical\n"
                     "  -C, --cband             Scan C-band\n"
                     "  -H, --high              Scan Ku-band high\n"
-                    "  -S, --slot=<slot>       NIM slot (0...3)\n"
-                    "  -I, --i2c=<id>          I2C device (0...3)\n",
+                    "  -S, --slot=<slot>       NIM slot\n"
+                    "  -L, --slots=<list>      Scan comma separated NIM slots in parallel\n"
+                    "  -A, --all-slots         Scan all NIM slots in parallel\n"
+                    "  -I, --i2c=<id>          I2C device (0...3)\n"
+                    "  -W, --settle-ms=<ms>    Delay after the frontend is ready in ms\n"
+                    "  -E, --external-lnb      Leave LNB voltage and tone to another process\n"
+                    "  -N, --lnb=<model>       LNB: universal, cband[:<lo>], custom:<lo>[:<high lo>],\n"
+                    "                          wideband[:<lo>], unicable:<ub>=<MHz>[/<width>],... or\n"
+                    "                          jess:<ub>=<MHz>[/<width>],... (user band width in MHz, default 40)\n"
+                    "  -R, --stream            Print transponders while the scan is running\n"
+                    "  -P, --plan=<segments>   Scan comma separated segments, e.g. H-low,V-low,H-high,V-high\n"
+                    "  -G, --campaign=<file>   Scan the plans of the DiSEqC positions listed in <file>\n"
+                    "  -B, --split=<width>     Split the range into sub-bands of <width> MHz shared by all slots\n"
+                    "  -D, --sr-split=<rate>   Scan symbol rates above <rate> MS/s first, then gaps below it\n"
+                    "  -Z, --prescan[=<MHz>]   Sample signal strength every <MHz> and only scan occupied ranges\n"
+                    "  -K, --cache=<dir>       Store results per slot, polarity and band in <dir>\n"
+                    "  -U, --incremental       Verify cached transponders and only scan the gaps\n"
+                    "  -c, --checkpoint=<file> Save the sub-ranges scanned and transponders found to <file>\n"
+                    "  -X, --resume            Continue the scan saved to the --checkpoint file\n"
+                    "  -M, --merge             Merge duplicate transponders and print them when done\n"
+                    "  -v, --verify=<slot>     Tune found transponders on <slot> and report lock\n"
+                    "  -F, --format=<format>   Output format: text, json or binary\n"
+                    "  -o, --output=<dest>     Write results through a buffer to a file, unix:<path>,\n"
+                    "                          tcp:<host>:<port> or - for stdout\n"
+                    "  -u, --line-flush        Write every result to --output as soon as it is found\n"
+                    "  -d, --daemon=<socket>   Serve scan requests on a UNIX socket\n"
+                    "  -p, --progress[=<ms>]   Report scan progress on stderr every <ms> ms\n"
+                    "  -T, --stats[=<file>]    Print timing statistics at exit, optionally in\n"
+                    "                          Prometheus text format to <file>\n"
+                    "  -m, --mock=<source>     Simulate frontends: synthetic:<records> or a trace file\n"
+                    "  -l, --mock-latency=<us> Delay of every simulated driver access in us\n"
+                    "  -r, --record=<file>     Record raw driver responses to <file>\n"
+                    "  -y, --replay=<file>     Replay a recorded scan with its original timing\n"
+                    "  -J, --mock-i2c=<buses>  Put the simulated tuners on <buses> shared I2C buses\n"
+                    "  -b, --bench=<tuners>    Scan on 1, 2, 4... up to <tuners> tuners at once and\n"
+                    "                          report throughput and driver access contention\n",
             argv[0]);
 }
 
@@ -68,446 +675,4934 @@ static bool get_int_arg(int *valp, const char *arg)
     return true;
 }
 
-static void handle_args(int argc, char **argv)
+static bool get_slots_arg(const char *arg)
 {
-    struct option longopts[] = {
-        {"start", required_argument, 0, 's'},
-        {"stop", required_argument, 0, 'e'},
-        {"min", required_argument, 0, 'n'},
-        {"max", required_argument, 0, 'x'},
-        {"vertical", no_argument, 0, 'V'},
-        {"cband", no_argument, 0, 'C'},
-        {"high", no_argument, 0, 'H'},
-        {"slot", required_argument, 0, 'S'},
-        {"i2c", required_argument, 0, 'I'},
-        {"help", no_argument, 0, 'h'},
-        {NULL, 0, 0, 0},
-    };
-    int c, longindex = 0, val;
+    char *endptr;
+    long int val;
+
+    num_slots = 0;
 
-    while ((c = getopt_long(argc, argv, "s:e:n:x:VCHS:I:h", longopts, &longindex)) != -1)
+    for (;;)
     {
-        switch (c)
-        {
-        case 's':
-            if (!get_int_arg(&val, optarg))
-                exit(EXIT_FAILURE);
-            start_frequency_mhz = val;
-            break;
-        case 'e':
-            if (!get_int_arg(&val, optarg))
-                exit(EXIT_FAILURE);
-            stop_frequency_mhz = val;
-            break;
-        case 'n':
-            if (!get_int_arg(&val, optarg))
-                exit(EXIT_FAILURE);
-            symbolrate_min_mhz = val;
-            break;
-        case 'x':
-            if (!get_int_arg(&val, optarg))
-                exit(EXIT_FAILURE);
-            symbolrate_max_mhz = val;
-            break;
-        case 'V':
-            vertical = true;
-            break;
-        case 'C':
-            cband = true;
-            break;
-        case 'H':
-            high = true;
-            break;
-        case 'S':
-            if (!get_int_arg(&val, optarg))
-                exit(EXIT_FAILURE);
-            slot = val;
-            break;
-        case 'I':
-            if (!get_int_arg(&val, optarg))
-                exit(EXIT_FAILURE);
-            i2c = val;
-            break;
-        case 'h':
-        case '?':
-            print_usage(argv);
-            break;
-        default:
-            exit(EXIT_FAILURE);
-            break;
-        }
-    }
-}
+        errno = 0;
+        val = strtol(arg, &endptr, 10);
 
-static ssize_t bs_read(const char *filename, void *buf, size_t count)
-{
-    int fd;
-    ssize_t rc = 0;
-    ssize_t todo = count;
+        if (errno != 0 || endptr == arg || val < 0 || val > INT_MAX)
+            return false;
 
-    fd = open(filename, O_RDWR);
-    if (fd < 0)
-        return -1;
+        if (num_slots == (int)(sizeof(slots) / sizeof(slots[0])))
+            return false;
 
-    while (todo)
-    {
-        do
-        {
-            rc = read(fd, buf, todo);
-        } while (rc < 0 && errno == EINTR);
+        slots[num_slots++] = (int)val;
 
-        if (rc <= 0)
+        if (*endptr == '\0')
             break;
 
-        buf = (char *)buf + rc;
-        todo -= rc;
-    }
+        if (*endptr != ',')
+            return false;
 
-    close(fd);
+        arg = endptr + 1;
+    }
 
-    return (count - todo) ? (count - todo) : rc;
+    return true;
 }
 
-static ssize_t bs_write(const char *filename, const void *buf, size_t count)
+static struct scan_job *jobs_push(const struct scan_job *tmpl)
 {
-    int fd;
-    ssize_t rc = 0;
-    ssize_t todo = count;
+    struct scan_job **list;
+    struct scan_job *job;
 
-    fd = open(filename, O_RDWR);
-    if (fd < 0)
-        return -1;
+    job = malloc(sizeof(*job));
+    if (job == NULL)
+        return NULL;
 
-    while (todo)
-    {
-        do
-        {
-            rc = write(fd, buf, todo);
-        } while (rc < 0 && errno == EINTR);
+    *job = *tmpl;
+    job->taken = false;
+    job->done = false;
 
-        if (rc <= 0)
-            break;
+    pthread_mutex_lock(&jobs_lock);
 
-        buf = (const char *)buf + rc;
-        todo -= rc;
+    list = realloc(jobs, (num_jobs + 1) * sizeof(*jobs));
+    if (list == NULL)
+    {
+        pthread_mutex_unlock(&jobs_lock);
+        free(job);
+        return NULL;
     }
 
-    close(fd);
+    jobs = list;
+    jobs[num_jobs++] = job;
 
-    return (count - todo) ? (count - todo) : rc;
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_lock);
+
+    return job;
 }
 
-static void blindscan(int fe_id)
+static int default_band(void)
 {
-    char bs_ctrl[PATH_MAX];
-    char bs_info[PATH_MAX];
-    char buf[BUFSIZ];
-    int ret;
-    int status, num_info, progress;
-    int index;
-    uint32_t frequency;
-    uint32_t symbol_rate;
-    int delivery_system;
-    int inversion;
-    int pilot;
-    int fec_inner;
-    int modulation;
-    int rolloff;
-    int pls_mode;
-    int is_id;
-    int pls_code;
-    int t2mi_plp_id;
-    int t2mi_pid;
-    char *s;
+    if (cband)
+        return BAND_CBAND;
 
-    sprintf(bs_ctrl, "/proc/stb/frontend/%d/bs_ctrl", fe_id);
-    if (access(bs_ctrl, R_OK))
-        return;
+    return high ? BAND_HIGH : BAND_LOW;
+}
 
-    sprintf(bs_info, "/proc/stb/frontend/%d/bs_info", fe_id);
-    if (access(bs_info, R_OK))
-        return;
+static struct scan_job *jobs_add(int slot_id, bool vert, int band)
+{
+    struct scan_job tmpl = {
+        .slot = slot_id,
+        .out = output,
+        .vertical = vert,
+        .band = band,
+        .start_frequency_mhz = start_frequency_mhz,
+        .stop_frequency_mhz = stop_frequency_mhz,
+        .symbolrate_min_mhz = symbolrate_min_mhz,
+        .symbolrate_max_mhz = symbolrate_max_mhz,
+    };
+    struct scan_job *job;
 
-    sprintf(buf, "1 %u %u %u %u",
-            start_frequency_mhz, stop_frequency_mhz,
-            symbolrate_min_mhz, symbolrate_max_mhz);
-    ret = bs_write(bs_ctrl, buf, strlen(buf));
-    if (ret < 0)
-        return;
+    job = jobs_push(&tmpl);
+    if (job == NULL)
+        exit(EXIT_FAILURE);
 
-    for (;;)
-    {
-        if (signal_status == SIGINT)
-        {
-            sprintf(buf, "0 0 0 0 0");
-            bs_write(bs_ctrl, buf, strlen(buf));
-            return;
-        }
+    return job;
+}
 
-        ret = bs_read(bs_ctrl, buf, sizeof(buf) - 1);
-        if (ret < 0)
-            return;
+static bool jobs_diseqc_busy(int diseqc)
+{
+    for (int i = 0; i < num_jobs; i++)
+    {
+        if (jobs[i]->taken && !jobs[i]->done && jobs[i]->diseqc == diseqc)
+            return true;
+    }
 
-        buf[ret] = '\0';
-        sscanf(buf, "%d%d%d", &status, &num_info, &progress);
-        if (!status)
-            break;
+    return false;
+}
 
-        usleep(100 * 1000);
-    }
+/*
+ * Pick the job for slot_id that keeps switch changes down: one on the
+ * switch position the frontend is already on, else one on a position no
+ * other frontend is working on, else the first one. Called with jobs_lock
+ * held.
+ */
+static struct scan_job *jobs_pick(int slot_id, int diseqc)
+{
+    struct scan_job *idle = NULL;
+    struct scan_job *any = NULL;
 
-    for (int i = 0; i < num_info && signal_status != SIGINT; i++)
+    for (int i = 0; i < num_jobs; i++)
     {
-        sprintf(buf, "%d", i);
-        ret = bs_write(bs_info, buf, strlen(buf));
-        if (ret < 0)
+        if (jobs[i]->taken || (jobs[i]->slot != -1 && jobs[i]->slot != slot_id))
             continue;
 
-        ret = bs_read(bs_info, buf, sizeof(buf) - 1);
-        if (ret < 0)
-            continue;
+        if (jobs[i]->diseqc == diseqc)
+            return jobs[i];
 
-        buf[ret] = '\0';
-        if (sscanf(buf, "%d%u%u%d%d%d%d%d%d%d%d%d%d%d",
-                   &index,
-                   &frequency,
-                   &symbol_rate,
-                   &delivery_system,
-                   &inversion,
-                   &pilot,
-                   &fec_inner,
-                   &modulation,
-                   &rolloff,
-                   &pls_mode,
-                   &is_id,
-                   &pls_code,
-                   &t2mi_plp_id,
-                   &t2mi_pid) != 14)
-            continue;
+        if (idle == NULL && !jobs_diseqc_busy(jobs[i]->diseqc))
+            idle = jobs[i];
 
-        if (i != index)
-            continue;
+        if (any == NULL)
+            any = jobs[i];
+    }
 
-        int j = sprintf(buf, "OK");
+    return idle ? idle : any;
+}
 
-        j += sprintf(buf + j, " %s", vertical ? "VERTICAL" : "HORIZONTAL");
+/*
+ * Take the next job for slot_id, preferring switch position diseqc, waiting
+ * for one to be queued if wait is set.
+ */
+static struct scan_job *jobs_next(int slot_id, int diseqc, bool wait)
+{
+    struct scan_job *job = NULL;
 
-        frequency = ((frequency + 500) / 1000) * 1000;
-        if (cband)
-            frequency = 5150000U - frequency;
-        else if (high)
-            frequency = frequency + 10600000U;
+    pthread_mutex_lock(&jobs_lock);
+
+    for (;;)
+    {
+        job = jobs_pick(slot_id, diseqc);
+        if (job)
+            job->taken = true;
+
+        if (job || !wait || signal_status)
+            break;
+
+        pthread_cond_wait(&jobs_cond, &jobs_lock);
+    }
+
+    pthread_mutex_unlock(&jobs_lock);
+
+    return job;
+}
+
+static void jobs_done(struct scan_job *job)
+{
+    pthread_mutex_lock(&jobs_lock);
+    job->done = true;
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+/*
+ * Wait for job to finish and drop it from the queue. On a signal a job no
+ * worker took is dropped right away, a taken one still writes the results
+ * its worker drains to job->out.
+ */
+static void jobs_wait(struct scan_job *job)
+{
+    pthread_mutex_lock(&jobs_lock);
+
+    while (!job->done && (job->taken || !signal_status))
+        pthread_cond_wait(&jobs_cond, &jobs_lock);
+
+    for (int i = 0; i < num_jobs; i++)
+    {
+        if (jobs[i] == job)
+        {
+            memmove(&jobs[i], &jobs[i + 1], (num_jobs - i - 1) * sizeof(*jobs));
+            num_jobs--;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&jobs_lock);
+
+    free(job);
+}
+
+static void jobs_free(void)
+{
+    for (int i = 0; i < num_jobs; i++)
+        free(jobs[i]);
+
+    free(jobs);
+    jobs = NULL;
+    num_jobs = 0;
+}
+
+/*
+ * Cut every job into sub-bands of width_mhz that overlap by the occupied
+ * bandwidth of the widest carrier, so a transponder on a boundary is fully
+ * inside at least one sub-band. Sub-bands are unpinned and handed to whichever
+ * frontend asks for work next.
+ */
+static void jobs_split(uint32_t width_mhz)
+{
+    struct scan_job **old = jobs;
+    int num_old = num_jobs;
+
+    if (!width_mhz)
+        return;
+
+    jobs = NULL;
+    num_jobs = 0;
+
+    for (int i = 0; i < num_old; i++)
+    {
+        uint32_t overlap = old[i]->symbolrate_max_mhz * 135 / 100 + 1;
+        uint32_t start = old[i]->start_frequency_mhz;
+
+        for (;;)
+        {
+            struct scan_job *job = jobs_add(-1, old[i]->vertical, old[i]->band);
+
+            job->diseqc = old[i]->diseqc;
+            job->start_frequency_mhz = start;
+            job->stop_frequency_mhz = start + width_mhz + overlap;
+            job->symbolrate_min_mhz = old[i]->symbolrate_min_mhz;
+            job->symbolrate_max_mhz = old[i]->symbolrate_max_mhz;
+
+            if (job->stop_frequency_mhz >= old[i]->stop_frequency_mhz)
+            {
+                job->stop_frequency_mhz = old[i]->stop_frequency_mhz;
+                break;
+            }
+
+            start += width_mhz;
+        }
+
+        free(old[i]);
+    }
+
+    free(old);
+}
+
+/*
+ * Sub-band width for num tuners scanning in parallel: --split if given, else
+ * an equal share of the range for each tuner behind a router.
+ */
+static uint32_t jobs_split_mhz(int num)
+{
+    if (split_mhz || !lnb.num_user_bands || num < 2 || stop_frequency_mhz <= start_frequency_mhz)
+        return split_mhz;
+
+    return (stop_frequency_mhz - start_frequency_mhz + num - 1) / num;
+}
+
+static bool get_diseqc_arg(int *diseqc, const char *arg)
+{
+    static const int max[] = {
+        [DISEQC_COMMITTED] = 3,
+        [DISEQC_UNCOMMITTED] = 15,
+        [DISEQC_POSITION] = 255,
+    };
+    const char *sep = strchr(arg, ':');
+    int kind, port;
+
+    if (sep == NULL)
+        return false;
+
+    for (kind = DISEQC_COMMITTED; kind <= DISEQC_POSITION; kind++)
+    {
+        if ((size_t)(sep - arg) == diseqc_names[kind].len && !strncmp(arg, diseqc_names[kind].s, sep - arg))
+            break;
+    }
+
+    if (kind > DISEQC_POSITION || !get_int_arg(&port, sep + 1) || port < 0 || port > max[kind])
+        return false;
+
+    *diseqc = DISEQC(kind, port);
+
+    return true;
+}
+
+static bool get_plan_arg(const char *arg, int diseqc)
+{
+    char segment[16];
+    const char *end;
+    size_t len;
+    bool vert;
+    int band;
+
+    for (;;)
+    {
+        end = strchr(arg, ',');
+        len = end ? (size_t)(end - arg) : strlen(arg);
+        if (len < 3 || len >= sizeof(segment) || arg[1] != '-')
+            return false;
+
+        memcpy(segment, arg, len);
+        segment[len] = '\0';
+
+        if (segment[0] == 'H' || segment[0] == 'h')
+            vert = false;
+        else if (segment[0] == 'V' || segment[0] == 'v')
+            vert = true;
         else
-            frequency = frequency + 9750000U;
+            return false;
+
+        if (!strcmp(segment + 2, "low"))
+            band = BAND_LOW;
+        else if (!strcmp(segment + 2, "high"))
+            band = BAND_HIGH;
+        else if (!strcmp(segment + 2, "cband"))
+            band = BAND_CBAND;
+        else
+            return false;
+
+        jobs_add(-1, vert, band)->diseqc = diseqc;
+
+        if (end == NULL)
+            break;
+
+        arg = end + 1;
+    }
+
+    return true;
+}
+
+/*
+ * A campaign file lists one switch position per line, followed by the plan
+ * segments to scan there:
+ *   committed:0 H-low,V-low,H-high,V-high
+ *   position:12 H-high
+ * Without segments the default band and polarity are scanned. Text after a
+ * '#' is ignored.
+ */
+static int campaign_load(const char *filename)
+{
+    FILE *fp;
+    char *line = NULL;
+    char *saveptr, *tok, *segments;
+    size_t len = 0;
+    int lineno = 0;
+    int diseqc;
+    int ret = 0;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+        return -1;
+
+    while (getline(&line, &len, fp) != -1)
+    {
+        lineno++;
+        line[strcspn(line, "#")] = '\0';
+
+        tok = strtok_r(line, " \t\r\n", &saveptr);
+        if (tok == NULL)
+            continue;
+
+        segments = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (!get_diseqc_arg(&diseqc, tok) || (segments && !get_plan_arg(segments, diseqc)))
+        {
+            fprintf(stderr, "ERROR %s:%d campaign entry\n", filename, lineno);
+            ret = -1;
+            break;
+        }
+
+        if (segments == NULL)
+            jobs_add(-1, vertical, default_band())->diseqc = diseqc;
+    }
+
+    free(line);
+    fclose(fp);
+
+    return ret;
+}
+
+static bool get_mhz_arg(uint32_t *khz, const char *arg)
+{
+    int val;
+
+    if (!get_int_arg(&val, arg) || val <= 0)
+        return false;
+
+    *khz = val * 1000U;
+
+    return true;
+}
+
+/*
+ * Parse an LNB model:
+ *   universal | cband[:<lo>] | custom:<lo>[:<high lo>] | wideband[:<lo>]
+ *   unicable:<ub>=<MHz>[,<ub>=<MHz>...] | jess:<ub>=<MHz>[,...]
+ * with oscillators in MHz.
+ */
+static bool get_lnb_arg(const char *arg)
+{
+    char buf[256];
+    char *params, *saveptr, *tok, *val, *width;
+    int type, ub, n;
+
+    if (strlen(arg) >= sizeof(buf))
+        return false;
+
+    strcpy(buf, arg);
+    params = strchr(buf, ':');
+    if (params)
+        *params++ = '\0';
+
+    for (type = 0; type < (int)(sizeof(lnb_names) / sizeof(lnb_names[0])); type++)
+    {
+        if (!strcmp(buf, lnb_names[type].s))
+            break;
+    }
+
+    lnb.type = type;
+    switch (type)
+    {
+    case LNB_UNIVERSAL:
+        return params == NULL;
+    case LNB_CBAND:
+        cband = true;
+        return params == NULL || get_mhz_arg(&lnb.lo_cband_khz, params);
+    case LNB_CUSTOM:
+    case LNB_WIDEBAND:
+        lnb.lo_low_khz = 10410000;
+        if (params == NULL)
+            return type == LNB_WIDEBAND;
+
+        val = strchr(params, ':');
+        if (val)
+            *val++ = '\0';
+
+        if (!get_mhz_arg(&lnb.lo_low_khz, params))
+            return false;
+
+        lnb.lo_high_khz = lnb.lo_low_khz;
+        return val == NULL || (type == LNB_CUSTOM && get_mhz_arg(&lnb.lo_high_khz, val));
+    case LNB_UNICABLE:
+    case LNB_JESS:
+        for (tok = strtok_r(params, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr))
+        {
+            val = strchr(tok, '=');
+            if (val == NULL || lnb.num_user_bands == LNB_USER_BANDS_MAX)
+                return false;
+
+            *val++ = '\0';
+            width = strchr(val, '/');
+            if (width)
+                *width++ = '\0';
+
+            n = SCR_WIDTH_MHZ;
+            if (!get_int_arg(&ub, tok) || ub < 0 || ub > (type == LNB_JESS ? 31 : 7) ||
+                !get_mhz_arg(&lnb.user_band_mhz[lnb.num_user_bands], val) ||
+                (width && !get_int_arg(&n, width)) || n <= SCR_STEP_MIN_MHZ + 1)
+                return false;
+
+            lnb.user_band_mhz[lnb.num_user_bands] /= 1000;
+            lnb.user_band_width_mhz[lnb.num_user_bands] = n;
+            lnb.user_band[lnb.num_user_bands++] = ub;
+        }
+        return lnb.num_user_bands > 0;
+    default:
+        return false;
+    }
+}
+
+static void handle_args(int argc, char **argv)
+{
+    struct option longopts[] = {
+        {"start", required_argument, 0, 's'},
+        {"stop", required_argument, 0, 'e'},
+        {"min", required_argument, 0, 'n'},
+        {"max", required_argument, 0, 'x'},
+        {"vertical", no_argument, 0, 'V'},
+        {"cband", no_argument, 0, 'C'},
+        {"high", no_argument, 0, 'H'},
+        {"slot", required_argument, 0, 'S'},
+        {"slots", required_argument, 0, 'L'},
+        {"all-slots", no_argument, 0, 'A'},
+        {"i2c", required_argument, 0, 'I'},
+        {"settle-ms", required_argument, 0, 'W'},
+        {"external-lnb", no_argument, 0, 'E'},
+        {"lnb", required_argument, 0, 'N'},
+        {"stream", no_argument, 0, 'R'},
+        {"plan", required_argument, 0, 'P'},
+        {"campaign", required_argument, 0, 'G'},
+        {"split", required_argument, 0, 'B'},
+        {"sr-split", required_argument, 0, 'D'},
+        {"prescan", optional_argument, 0, 'Z'},
+        {"cache", required_argument, 0, 'K'},
+        {"incremental", no_argument, 0, 'U'},
+        {"checkpoint", required_argument, 0, 'c'},
+        {"resume", no_argument, 0, 'X'},
+        {"merge", no_argument, 0, 'M'},
+        {"verify", required_argument, 0, 'v'},
+        {"format", required_argument, 0, 'F'},
+        {"output", required_argument, 0, 'o'},
+        {"line-flush", no_argument, 0, 'u'},
+        {"daemon", required_argument, 0, 'd'},
+        {"progress", optional_argument, 0, 'p'},
+        {"stats", optional_argument, 0, 'T'},
+        {"mock", required_argument, 0, 'm'},
+        {"mock-latency", required_argument, 0, 'l'},
+        {"record", required_argument, 0, 'r'},
+        {"replay", required_argument, 0, 'y'},
+        {"mock-i2c", required_argument, 0, 'J'},
+        {"bench", required_argument, 0, 'b'},
+        {"help", no_argument, 0, 'h'},
+        {NULL, 0, 0, 0},
+    };
+    int c, longindex = 0, val;
+
+    while ((c = getopt_long(argc, argv, "s:e:n:x:VCHS:L:AI:W:EN:RP:G:B:D:Z::K:Uc:XMv:F:o:ud:p::T::m:l:r:y:J:b:h", longopts, &longindex)) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            if (!get_int_arg(&val, optarg))
+                exit(EXIT_FAILURE);
+            start_frequency_mhz = val;
+            range_set = true;
+            break;
+        case 'e':
+            if (!get_int_arg(&val, optarg))
+                exit(EXIT_FAILURE);
+            stop_frequency_mhz = val;
+            range_set = true;
+            break;
+        case 'n':
+            if (!get_int_arg(&val, optarg))
+                exit(EXIT_FAILURE);
+            symbolrate_min_mhz = val;
+            break;
+        case 'x':
+            if (!get_int_arg(&val, optarg))
+                exit(EXIT_FAILURE);
+            symbolrate_max_mhz = val;
+            symbolrate_max_set = true;
+            break;
+        case 'V':
+            vertical = true;
+            break;
+        case 'C':
+            cband = true;
+            break;
+        case 'H':
+            high = true;
+            break;
+        case 'S':
+            if (!get_int_arg(&val, optarg))
+                exit(EXIT_FAILURE);
+            slot = val;
+            break;
+        case 'L':
+            if (!get_slots_arg(optarg))
+                exit(EXIT_FAILURE);
+            break;
+        case 'A':
+            all_slots = true;
+            break;
+        case 'I':
+            if (!get_int_arg(&val, optarg))
+                exit(EXIT_FAILURE);
+            i2c = val;
+            break;
+        case 'W':
+            if (!get_int_arg(&val, optarg) || val < 0)
+                exit(EXIT_FAILURE);
+            settle_ms = val;
+            break;
+        case 'E':
+            external_lnb = true;
+            break;
+        case 'N':
+            if (!get_lnb_arg(optarg))
+                exit(EXIT_FAILURE);
+            break;
+        case 'R':
+            stream = true;
+            break;
+        case 'P':
+            plan = optarg;
+            break;
+        case 'G':
+            campaign = optarg;
+            break;
+        case 'B':
+            if (!get_int_arg(&val, optarg) || val <= 0)
+                exit(EXIT_FAILURE);
+            split_mhz = val;
+            break;
+        case 'D':
+            if (!get_int_arg(&val, optarg) || val <= 0)
+                exit(EXIT_FAILURE);
+            symbolrate_split_mhz = val;
+            break;
+        case 'Z':
+            val = PRESCAN_DEFAULT_MHZ;
+            if (optarg && (!get_int_arg(&val, optarg) || val <= 0))
+                exit(EXIT_FAILURE);
+            prescan_mhz = val;
+            break;
+        case 'K':
+            cache_dir = optarg;
+            break;
+        case 'U':
+            incremental = true;
+            break;
+        case 'c':
+            checkpoint_path = optarg;
+            break;
+        case 'X':
+            resume = true;
+            break;
+        case 'M':
+            merge = true;
+            break;
+        case 'v':
+            if (!get_int_arg(&val, optarg) || val < 0)
+                exit(EXIT_FAILURE);
+            verify_slot = val;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'u':
+            output_line = true;
+            break;
+        case 'F':
+            if (!strcmp(optarg, "text"))
+                format = FORMAT_TEXT;
+            else if (!strcmp(optarg, "json"))
+                format = FORMAT_JSON;
+            else if (!strcmp(optarg, "binary"))
+                format = FORMAT_BINARY;
+            else
+                exit(EXIT_FAILURE);
+            break;
+        case 'd':
+            daemon_path = optarg;
+            break;
+        case 'p':
+            progress_ms = PROGRESS_DEFAULT_MS;
+            if (optarg && (!get_int_arg(&val, optarg) || val <= 0))
+                exit(EXIT_FAILURE);
+            if (optarg)
+                progress_ms = val;
+            break;
+        case 'T':
+            stats_enabled = true;
+            stats_path = optarg;
+            break;
+        case 'm':
+            mock_source = optarg;
+            if (!strncmp(optarg, "synthetic:", 10) && (!get_int_arg(&val, optarg + 10) || val < 0))
+                exit(EXIT_FAILURE);
+            break;
+        case 'l':
+            if (!get_int_arg(&val, optarg) || val < 0)
+                exit(EXIT_FAILURE);
+            mock_latency_us = val;
+            break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 'y':
+            mock_source = optarg;
+            mock_replay = true;
+            break;
+        case 'J':
+            if (!get_int_arg(&val, optarg) || val < 0 || val > NIM_SLOTS_MAX)
+                exit(EXIT_FAILURE);
+            mock_i2c_buses = val;
+            break;
+        case 'b':
+            if (!get_int_arg(&val, optarg) || val <= 0 || val > NIM_SLOTS_MAX)
+                exit(EXIT_FAILURE);
+            bench_tuners = val;
+            break;
+        case 'h':
+        case '?':
+            print_usage(argv);
+            break;
+        default:
+            exit(EXIT_FAILURE);
+            break;
+        }
+    }
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t stats_begin(void)
+{
+    return stats_enabled ? now_us() : 0;
+}
+
+static void stats_end(int id, uint64_t begin_us)
+{
+    struct histogram *h = &stats[id];
+    uint64_t us;
+    int b = 0;
+
+    if (!stats_enabled)
+        return;
+
+    us = now_us() - begin_us;
+    while (b < HIST_BUCKETS - 1 && us >= (1ULL << b))
+        b++;
+
+    pthread_mutex_lock(&stats_lock);
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us)
+        h->max_us = us;
+    h->buckets[b]++;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static uint64_t bench_begin(void)
+{
+    return bench_tuners ? now_us() : 0;
+}
+
+/* Time driver accesses per session, without the lock of the global stats. */
+static void bench_end(struct bs_session *session, uint64_t begin_us)
+{
+    if (!bench_tuners)
+        return;
+
+    session->io_us += now_us() - begin_us;
+    session->io_calls++;
+}
+
+static void stats_syscalls(uint64_t syscalls)
+{
+    pthread_mutex_lock(&stats_lock);
+    stats_syscalls_total += syscalls;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_result(void)
+{
+    if (!stats_enabled)
+        return;
+
+    pthread_mutex_lock(&stats_lock);
+    if (!stats_first_result_us)
+        stats_first_result_us = now_us() - stats_start_us;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* Upper bound of the bucket holding the given quantile. */
+static uint64_t stats_quantile(const struct histogram *h, double q)
+{
+    uint64_t rank = (uint64_t)(h->count * q);
+    uint64_t seen_count = 0;
+
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        seen_count += h->buckets[b];
+        if (seen_count > rank)
+            return b < HIST_BUCKETS - 1 && (1ULL << b) < h->max_us ? 1ULL << b : h->max_us;
+    }
+
+    return h->max_us;
+}
+
+static void stats_prometheus(FILE *fp, uint64_t total_us)
+{
+    for (int i = 0; i < STAT_MAX; i++)
+    {
+        const struct histogram *h = &stats[i];
+        uint64_t cumulative = 0;
+
+        fprintf(fp, "# HELP blindscan_%s_seconds %s\n", h->name, h->help);
+        fprintf(fp, "# TYPE blindscan_%s_seconds histogram\n", h->name);
+
+        for (int b = 0; b < HIST_BUCKETS - 1; b++)
+        {
+            cumulative += h->buckets[b];
+            fprintf(fp, "blindscan_%s_seconds_bucket{le=\"%g\"} %" PRIu64 "\n",
+                    h->name, (1ULL << b) / 1e6, cumulative);
+        }
+
+        fprintf(fp, "blindscan_%s_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n", h->name, h->count);
+        fprintf(fp, "blindscan_%s_seconds_sum %g\n", h->name, h->sum_us / 1e6);
+        fprintf(fp, "blindscan_%s_seconds_count %" PRIu64 "\n", h->name, h->count);
+    }
+
+    fprintf(fp, "# HELP blindscan_first_result_seconds Time from start to the first transponder\n");
+    fprintf(fp, "# TYPE blindscan_first_result_seconds gauge\n");
+    fprintf(fp, "blindscan_first_result_seconds %g\n", stats_first_result_us / 1e6);
+    fprintf(fp, "# HELP blindscan_run_seconds Total run time\n");
+    fprintf(fp, "# TYPE blindscan_run_seconds gauge\n");
+    fprintf(fp, "blindscan_run_seconds %g\n", total_us / 1e6);
+    fprintf(fp, "# HELP blindscan_syscalls_total Driver I/O system calls\n");
+    fprintf(fp, "# TYPE blindscan_syscalls_total counter\n");
+    fprintf(fp, "blindscan_syscalls_total %" PRIu64 "\n", stats_syscalls_total);
+}
+
+static void stats_report(void)
+{
+    uint64_t total_us = now_us() - stats_start_us;
+    uint64_t records = stats[STAT_FORMAT].count;
+    FILE *fp;
+
+    if (!stats_enabled)
+        return;
+
+    fprintf(stderr, "STATS total=%.3fs first_result=%.3fs\n",
+            total_us / 1e6, stats_first_result_us / 1e6);
+    fprintf(stderr, "STATS records=%" PRIu64 " records_per_s=%.1f syscalls=%" PRIu64 " syscalls_per_record=%.2f\n",
+            records, total_us ? records * 1e6 / total_us : 0.0, stats_syscalls_total,
+            records ? (double)stats_syscalls_total / records : 0.0);
+    if (campaign)
+        fprintf(stderr, "STATS switch_changes=%" PRIu64 "\n", stats_switch_changes);
+
+    for (int i = 0; i < STAT_MAX; i++)
+    {
+        const struct histogram *h = &stats[i];
+
+        fprintf(stderr, "STATS %s count=%" PRIu64 " mean=%" PRIu64 "us p50=%" PRIu64 "us p99=%" PRIu64 "us max=%" PRIu64 "us\n",
+                h->name, h->count, h->count ? h->sum_us / h->count : 0,
+                stats_quantile(h, 0.5), stats_quantile(h, 0.99), h->max_us);
+    }
+
+    if (stats_path == NULL)
+        return;
+
+    fp = fopen(stats_path, "w");
+    if (fp == NULL)
+        return;
+
+    stats_prometheus(fp, total_us);
+    fclose(fp);
+}
+
+static const struct bs_field bs_status_fields[] = {
+    BS_FIELD(bs_status, status, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_status, num_info, 0, INT32_MAX),
+    BS_FIELD(bs_status, progress, INT32_MIN, INT32_MAX),
+};
+
+static const struct bs_field bs_result_fields[] = {
+    BS_FIELD(bs_result, index, 0, INT32_MAX),
+    BS_FIELD(bs_result, frequency, 0, UINT32_MAX),
+    BS_FIELD(bs_result, symbol_rate, 0, UINT32_MAX),
+    BS_FIELD(bs_result, delivery_system, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, inversion, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, pilot, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, fec_inner, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, modulation, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, rolloff, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, pls_mode, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, is_id, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, pls_code, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, t2mi_plp_id, INT32_MIN, INT32_MAX),
+    BS_FIELD(bs_result, t2mi_pid, INT32_MIN, INT32_MAX),
+};
+
+#define NUM_STATUS_FIELDS (int)(sizeof(bs_status_fields) / sizeof(bs_status_fields[0]))
+#define NUM_RESULT_FIELDS (int)(sizeof(bs_result_fields) / sizeof(bs_result_fields[0]))
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/*
+ * Parse up to num blank separated decimal fields of the line at *p, which
+ * ends at end or at the first newline, into the members of rec. Fields past
+ * num are ignored. On success *p is left at the start of the next line, on
+ * failure at the offending character. Returns the number of fields stored.
+ */
+static int parse_fields(const char **p, const char *end, const struct bs_field *fields,
+                        int num, void *rec)
+{
+    const char *s = *p;
+    const char *digits;
+    int64_t val;
+    bool neg;
+    int i;
+
+    for (i = 0; i < num; i++)
+    {
+        while (s < end && is_blank(*s))
+            s++;
+
+        neg = s < end && *s == '-';
+        if (neg)
+            s++;
+
+        val = 0;
+        digits = s;
+        while (s < end && *s >= '0' && *s <= '9' && val <= UINT32_MAX)
+            val = val * 10 + (*s++ - '0');
+
+        if (s < end && *s >= '0' && *s <= '9')
+            val = INT64_MAX;
+        else if (s == digits || (s < end && !is_blank(*s) && *s != '\n'))
+            break;
+
+        if (neg)
+            val = -val;
+
+        if (val < fields[i].min || val > fields[i].max)
+        {
+            s = digits - neg;
+            break;
+        }
+
+        if (fields[i].max > INT32_MAX)
+            *(uint32_t *)((char *)rec + fields[i].offset) = val;
+        else
+            *(int32_t *)((char *)rec + fields[i].offset) = val;
+    }
+
+    if (i == num)
+    {
+        while (s < end && *s != '\n')
+            s++;
+        if (s < end)
+            s++;
+    }
+
+    *p = s;
+
+    return i;
+}
+
+static void parse_error(const char *what, const struct bs_field *field,
+                        const char *line, const char *pos, const char *end)
+{
+    const char *eol = memchr(line, '\n', end - line);
+
+    if (eol == NULL)
+        eol = end;
+
+    fprintf(stderr, "ERROR %s field=%s column=%d line=\"%.*s\"\n",
+            what, field->name, (int)(pos - line) + 1, (int)(eol - line), line);
+}
+
+static int bs_parse_status(const char *what, const char *buf, size_t len, struct bs_status *st)
+{
+    const char *p = buf;
+    int n;
+
+    n = parse_fields(&p, buf + len, bs_status_fields, NUM_STATUS_FIELDS, st);
+    if (n < NUM_STATUS_FIELDS)
+    {
+        parse_error(what, &bs_status_fields[n], buf, p, buf + len);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Parse the bs_info record at *p and advance *p to the following line. */
+static int bs_parse_result(const char *what, const char **p, const char *end, struct bs_result *r)
+{
+    const char *line = *p;
+    int n;
+
+    n = parse_fields(p, end, bs_result_fields, NUM_RESULT_FIELDS, r);
+    if (n < NUM_RESULT_FIELDS)
+    {
+        parse_error(what, &bs_result_fields[n], line, *p, end);
+        return -1;
+    }
+
+    return 0;
+}
+
+static ssize_t bs_read(int fd, void *buf, size_t count, uint64_t *syscalls)
+{
+    ssize_t rc = 0;
+    ssize_t todo = count;
+    off_t offset = 0;
+
+    while (todo)
+    {
+        do
+        {
+            rc = pread(fd, buf, todo, offset);
+            (*syscalls)++;
+        } while (rc < 0 && errno == EINTR);
+
+        if (rc <= 0)
+            break;
+
+        buf = (char *)buf + rc;
+        todo -= rc;
+        offset += rc;
+    }
+
+    return (count - todo) ? (ssize_t)(count - todo) : rc;
+}
+
+static ssize_t bs_write(int fd, const void *buf, size_t count, uint64_t *syscalls)
+{
+    ssize_t rc = 0;
+    ssize_t todo = count;
+    off_t offset = 0;
+
+    while (todo)
+    {
+        do
+        {
+            rc = pwrite(fd, buf, todo, offset);
+            (*syscalls)++;
+        } while (rc < 0 && errno == EINTR);
+
+        if (rc <= 0)
+            break;
+
+        buf = (const char *)buf + rc;
+        todo -= rc;
+        offset += rc;
+    }
+
+    return (count - todo) ? (ssize_t)(count - todo) : rc;
+}
+
+static int frontend_lock(int fe_id)
+{
+    char filename[PATH_MAX];
+    char str[16];
+    int fd;
+
+    sprintf(filename, "/var/run/blindscan.%d.pid", fe_id);
+
+    fd = open(filename, O_RDWR | O_CREAT, 0664);
+    if (fd < 0)
+        return -1;
+
+    if (flock(fd, LOCK_EX | LOCK_NB))
+    {
+        close(fd);
+        return -1;
+    }
+
+    sprintf(str, "%d\n", getpid());
+    if (ftruncate(fd, 0) || write(fd, str, strlen(str)) == -1)
+    {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void frontend_unlock(int fd)
+{
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static int frontend_open_ready(const char *bs_ctrl, uint64_t *syscalls)
+{
+    char buf[64];
+    const char *p;
+    ssize_t ret;
+    struct bs_status st;
+    int fd = -1;
+
+    for (int waited = 0;; waited += READY_POLL_MS)
+    {
+        if (fd < 0)
+            fd = open(bs_ctrl, O_RDWR);
+
+        if (fd >= 0)
+        {
+            ret = bs_read(fd, buf, sizeof(buf), syscalls);
+            p = buf;
+            if (ret > 0 && parse_fields(&p, buf + ret, bs_status_fields, 1, &st) == 1 && !st.status)
+                break;
+        }
+
+        if (waited >= READY_TIMEOUT_MS || signal_status)
+        {
+            if (fd < 0)
+                return -1;
+            break;
+        }
+
+        usleep(READY_POLL_MS * 1000);
+    }
+
+    if (settle_ms)
+        usleep(settle_ms * 1000);
+
+    return fd;
+}
+
+static int dvb_open(int fe_id)
+{
+    char filename[PATH_MAX];
+
+    sprintf(filename, "/dev/dvb/adapter0/frontend%d", fe_id);
+
+    return open(filename, O_RDWR | O_NONBLOCK);
+}
+
+/* The frontend device for LNB control, opened on first use. */
+static int lnb_fd(struct bs_session *session)
+{
+    if (session->dvb_fd == -1)
+        session->dvb_fd = dvb_open(session->fe_id);
+
+    /* Leave the LNB alone if the frontend is busy, and don't retry. */
+    if (session->dvb_fd < 0)
+        session->dvb_fd = -2;
+
+    return session->dvb_fd;
+}
+
+static int procfs_open(struct bs_session *session)
+{
+    char filename[PATH_MAX];
+
+    session->lock_fd = frontend_lock(session->fe_id);
+    if (session->lock_fd < 0)
+        return -1;
+
+    sprintf(filename, "/proc/stb/frontend/%d/bs_ctrl", session->fe_id);
+    session->ctrl_fd = frontend_open_ready(filename, &session->syscalls);
+    if (session->ctrl_fd < 0)
+        goto err;
+
+    sprintf(filename, "/proc/stb/frontend/%d/bs_info", session->fe_id);
+    session->info_fd = open(filename, O_RDWR);
+    if (session->info_fd < 0)
+        goto err;
+
+    return 0;
+
+err:
+    if (session->ctrl_fd >= 0)
+        close(session->ctrl_fd);
+    frontend_unlock(session->lock_fd);
+    return -1;
+}
+
+static void procfs_close(struct bs_session *session)
+{
+    close(session->info_fd);
+    close(session->ctrl_fd);
+    frontend_unlock(session->lock_fd);
+}
+
+static ssize_t procfs_ctrl_read(struct bs_session *session, char *buf, size_t count)
+{
+    return bs_read(session->ctrl_fd, buf, count, &session->syscalls);
+}
+
+static ssize_t procfs_ctrl_write(struct bs_session *session, const char *buf, size_t count)
+{
+    return bs_write(session->ctrl_fd, buf, count, &session->syscalls);
+}
+
+static ssize_t procfs_info_read(struct bs_session *session, char *buf, size_t count)
+{
+    return bs_read(session->info_fd, buf, count, &session->syscalls);
+}
+
+static ssize_t procfs_info_write(struct bs_session *session, const char *buf, size_t count)
+{
+    return bs_write(session->info_fd, buf, count, &session->syscalls);
+}
+
+/*
+ * Wait for the driver to signal a bs_ctrl change with POLLPRI. Nodes without
+ * poll support never report POLLPRI, so this degrades into a plain sleep.
+ * Returns true when woken by the driver.
+ */
+static bool procfs_wait(struct bs_session *session, int timeout_ms)
+{
+    struct pollfd pfd = {
+        .fd = session->ctrl_fd,
+        .events = POLLPRI,
+    };
+    int ret;
+
+    if (!session->ctrl_pollable)
+    {
+        usleep(timeout_ms * 1000);
+        return false;
+    }
+
+    do
+    {
+        ret = poll(&pfd, 1, timeout_ms);
+        session->syscalls++;
+    } while (ret < 0 && errno == EINTR && !signal_status);
+
+    if (ret <= 0)
+        return false;
+
+    if (pfd.revents & (POLLERR | POLLNVAL))
+    {
+        session->ctrl_pollable = false;
+        return false;
+    }
+
+    return (pfd.revents & POLLPRI) != 0;
+}
+
+/*
+ * Coarse power at if_mhz, sampled by tuning there without waiting for lock.
+ * Levels are in 0.001 dB if the driver reports decibels and in its relative
+ * units otherwise; only their spread is used.
+ */
+static bool procfs_power(struct bs_session *session, uint32_t if_mhz, int64_t *level)
+{
+    struct dtv_property p[] = {
+        {.cmd = DTV_CLEAR},
+        {.cmd = DTV_DELIVERY_SYSTEM, .u.data = SYS_DVBS2},
+        {.cmd = DTV_FREQUENCY, .u.data = if_mhz * 1000},
+        {.cmd = DTV_SYMBOL_RATE, .u.data = PRESCAN_SYMBOL_RATE},
+        {.cmd = DTV_INNER_FEC, .u.data = FEC_AUTO},
+        {.cmd = DTV_TUNE},
+    };
+    struct dtv_properties props = {
+        .num = sizeof(p) / sizeof(p[0]),
+        .props = p,
+    };
+    struct dtv_property stat = {.cmd = DTV_STAT_SIGNAL_STRENGTH};
+    struct dtv_properties stats = {
+        .num = 1,
+        .props = &stat,
+    };
+    uint16_t strength;
+    fe_status_t status = 0;
+    int fd = lnb_fd(session);
+
+    if (fd < 0 || ioctl(fd, FE_SET_PROPERTY, &props) < 0)
+        return false;
+
+    /* Read the level once the frontend sees a signal, or has had time to. */
+    for (int ms = 0; ms < PRESCAN_SETTLE_MS; ms += PRESCAN_DWELL_MS)
+    {
+        usleep(PRESCAN_DWELL_MS * 1000);
+        if (ioctl(fd, FE_READ_STATUS, &status) == 0 && (status & FE_HAS_SIGNAL))
+            break;
+    }
+
+    if (ioctl(fd, FE_GET_PROPERTY, &stats) == 0 && stat.u.st.len)
+    {
+        if (stat.u.st.stat[0].scale == FE_SCALE_DECIBEL)
+        {
+            *level = stat.u.st.stat[0].svalue;
+            return true;
+        }
+
+        if (stat.u.st.stat[0].scale == FE_SCALE_RELATIVE)
+        {
+            *level = stat.u.st.stat[0].uvalue;
+            return true;
+        }
+    }
+
+    if (ioctl(fd, FE_READ_SIGNAL_STRENGTH, &strength) < 0)
+        return false;
+
+    *level = strength;
+
+    return true;
+}
+
+static const struct bs_backend procfs_backend = {
+    .open = procfs_open,
+    .close = procfs_close,
+    .ctrl_read = procfs_ctrl_read,
+    .ctrl_write = procfs_ctrl_write,
+    .info_read = procfs_info_read,
+    .info_write = procfs_info_write,
+    .wait = procfs_wait,
+    .power = procfs_power,
+};
+
+static int format_raw(char *buf, size_t size, int index, const struct bs_result *r)
+{
+    return snprintf(buf, size, "%d %u %u %d %d %d %d %d %d %d %d %d %d %d\n",
+                    index, r->frequency, r->symbol_rate, r->delivery_system,
+                    r->inversion, r->pilot, r->fec_inner, r->modulation,
+                    r->rolloff, r->pls_mode, r->is_id, r->pls_code,
+                    r->t2mi_plp_id, r->t2mi_pid);
+}
+
+/* Carriers of the synthetic backend cycle through these symbol rates. */
+static const uint32_t mock_rates[] = {27500000, 2200000, 30000000, 7200000, 45000000, 3600000};
+
+/* Tuners on a shared simulated I2C bus wait for each other's accesses. */
+static void mock_delay(const struct bs_session *session)
+{
+    pthread_mutex_t *bus = NULL;
+
+    if (!mock_latency_us)
+        return;
+
+    if (mock_i2c_buses && session)
+        bus = &mock_bus_lock[session->fe_id % mock_i2c_buses];
+
+    if (bus)
+        pthread_mutex_lock(bus);
+    usleep(mock_latency_us);
+    if (bus)
+        pthread_mutex_unlock(bus);
+}
+
+static struct mock_segment *mock_add_segment(uint64_t start_us)
+{
+    struct mock_segment *seg;
+
+    seg = realloc(mock_trace.seg, (mock_trace.num + 1) * sizeof(*seg));
+    if (seg == NULL)
+        return NULL;
+
+    mock_trace.seg = seg;
+    seg = &mock_trace.seg[mock_trace.num++];
+    memset(seg, 0, sizeof(*seg));
+    seg->start_us = start_us;
+
+    return seg;
+}
+
+static bool mock_add_line(char ***list, int *num, const char *line)
+{
+    char **l;
+
+    l = realloc(*list, (*num + 1) * sizeof(*l));
+    if (l == NULL)
+        return false;
+
+    *list = l;
+    l[*num] = strdup(line);
+
+    return l[(*num)++] != NULL;
+}
+
+/*
+ * Trace files hold one "<usec> <kind> <payload>" line per driver access, as
+ * written by --record: S for a bs_ctrl scan command, C for a bs_ctrl status
+ * and I for a bs_info record. C and I lines before the first S belong to an
+ * implicit first scan.
+ */
+static int mock_load_trace(const char *filename)
+{
+    struct mock_segment *seg = NULL;
+    FILE *fp;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t n;
+    uint64_t ts;
+    uint64_t *us;
+    char kind;
+    int offset;
+    int lineno = 0;
+    char what[PATH_MAX + 16];
+    struct bs_status st;
+    struct bs_result r;
+    const char *p;
+    bool ok = true;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+        return -1;
+
+    while (ok && (n = getline(&line, &len, fp)) != -1)
+    {
+        lineno++;
+        if (n && line[n - 1] == '\n')
+            line[--n] = '\0';
+
+        if (n == 0)
+            continue;
+
+        snprintf(what, sizeof(what), "%s:%d", filename, lineno);
+        if (sscanf(line, "%" SCNu64 " %c %n", &ts, &kind, &offset) != 2 ||
+            (kind != 'S' && kind != 'C' && kind != 'I'))
+        {
+            fprintf(stderr, "ERROR %s line=\"%s\"\n", what, line);
+            ok = false;
+            break;
+        }
+
+        p = line + offset;
+        if ((kind == 'C' && bs_parse_status(what, p, n - offset, &st) < 0) ||
+            (kind == 'I' && bs_parse_result(what, &p, line + n, &r) < 0))
+        {
+            ok = false;
+            break;
+        }
+
+        if (kind == 'S' || seg == NULL)
+        {
+            seg = mock_add_segment(ts);
+            if (seg == NULL)
+                break;
+        }
+
+        if (kind == 'C')
+        {
+            us = realloc(seg->ctrl_us, (seg->num_ctrl + 1) * sizeof(*us));
+            if (us == NULL)
+                break;
+            seg->ctrl_us = us;
+            us[seg->num_ctrl] = ts;
+            ok = mock_add_line(&seg->ctrl, &seg->num_ctrl, line + offset);
+        }
+        else if (kind == 'I')
+        {
+            ok = mock_add_line(&seg->info, &seg->num_info, line + offset);
+        }
+    }
+
+    free(line);
+    fclose(fp);
+
+    return ok ? 0 : -1;
+}
+
+static int mock_open(struct bs_session *session)
+{
+    struct mock_state *m;
+
+    m = calloc(1, sizeof(*m));
+    if (m == NULL)
+        return -1;
+
+    m->seg = -1;
+    session->priv = m;
+
+    return 0;
+}
+
+static void mock_close(struct bs_session *session)
+{
+    free(session->priv);
+}
+
+static ssize_t mock_ctrl_read(struct bs_session *session, char *buf, size_t count)
+{
+    struct mock_state *m = session->priv;
+    int num_info;
+
+    mock_delay(session);
+    session->syscalls += 2;
+
+    if (mock_trace.seg)
+    {
+        const struct mock_segment *seg;
+
+        if (!m->status || m->seg >= mock_trace.num)
+            return snprintf(buf, count, "0 %d 100", m->num);
+
+        seg = &mock_trace.seg[m->seg];
+        if (m->ctrl_pos >= seg->num_ctrl)
+            return snprintf(buf, count, "0 %d 100", seg->num_info);
+
+        if (mock_replay)
+        {
+            uint64_t due = m->replay_start_us + seg->ctrl_us[m->ctrl_pos] - seg->start_us;
+            uint64_t now = now_us();
+
+            if (due > now)
+                usleep(due - now);
+        }
+
+        {
+            const char *line = seg->ctrl[m->ctrl_pos];
+            struct bs_status st;
+
+            if (parse_fields(&line, line + strlen(line), bs_status_fields, 2, &st) == 2)
+                m->num = st.num_info;
+        }
+        return snprintf(buf, count, "%s", seg->ctrl[m->ctrl_pos++]);
+    }
+
+    if (m->status)
+    {
+        /* The simulated driver sweeps MOCK_STEP_MHZ per status read. */
+        m->progress += m->stop - m->start > MOCK_STEP_MHZ ? 100 * MOCK_STEP_MHZ / (m->stop - m->start) : 100;
+        if (m->progress >= 100)
+        {
+            m->progress = 100;
+            m->status = 0;
+        }
+    }
+
+    num_info = (int)((int64_t)m->num * m->progress / 100);
+
+    return snprintf(buf, count, "%d %d %d", m->status, num_info, m->progress);
+}
+
+static ssize_t mock_ctrl_write(struct bs_session *session, const char *buf, size_t count)
+{
+    struct mock_state *m = session->priv;
+    int cmd;
+
+    mock_delay(session);
+    session->syscalls++;
+
+    if (sscanf(buf, "%d %u %u", &cmd, &m->start, &m->stop) < 1)
+        return -1;
+
+    if (!cmd && m->status)
+    {
+        /* A stopped scan keeps the records found so far. */
+        if (!mock_trace.seg)
+            m->num = (int)((int64_t)m->num * m->progress / 100);
+        m->status = 0;
+        m->progress = 100;
+        return count;
+    }
+
+    m->status = cmd;
+    m->progress = 0;
+    m->ctrl_pos = 0;
+    m->num = cmd && !mock_trace.seg ? mock_records : 0;
+    if (cmd)
+    {
+        m->seg++;
+        m->replay_start_us = now_us();
+    }
+    if (m->stop < m->start)
+        m->stop = m->start;
+
+    return count;
+}
+
+static ssize_t mock_info_write(struct bs_session *session, const char *buf, size_t count)
+{
+    struct mock_state *m = session->priv;
+    int n;
+
+    mock_delay(session);
+    session->syscalls++;
+
+    n = sscanf(buf, "%d %d", &m->info_first, &m->info_last);
+    if (n < 1)
+        return -1;
+
+    if (n < 2)
+        m->info_last = m->info_first;
+
+    return count;
+}
+
+static const char *mock_trace_info(const struct mock_state *m, int i)
+{
+    const struct mock_segment *seg;
+
+    if (m->seg < 0 || m->seg >= mock_trace.num)
+        return NULL;
+
+    seg = &mock_trace.seg[m->seg];
+    if (i >= 0 && i < seg->num_info && atoi(seg->info[i]) == i)
+        return seg->info[i];
+
+    for (int j = 0; j < seg->num_info; j++)
+    {
+        if (atoi(seg->info[j]) == i)
+            return seg->info[j];
+    }
+
+    return NULL;
+}
+
+static ssize_t mock_info_read(struct bs_session *session, char *buf, size_t count)
+{
+    struct mock_state *m = session->priv;
+    struct bs_result r;
+    size_t len = 0;
+
+    mock_delay(session);
+    session->syscalls += 2;
+
+    for (int i = m->info_first; i <= m->info_last && len < count; i++)
+    {
+        if (mock_trace.seg)
+        {
+            const char *line = mock_trace_info(m, i);
+
+            if (line == NULL)
+                break;
+            len += snprintf(buf + len, count - len, "%s\n", line);
+            continue;
+        }
+
+        if (i < 0 || i >= m->num)
+            break;
+
+        memset(&r, 0, sizeof(r));
+        r.frequency = m->start * 1000 + (uint32_t)((uint64_t)(m->stop - m->start) * 1000 * (2 * i + 1) / (2 * m->num));
+        r.symbol_rate = mock_rates[i % (sizeof(mock_rates) / sizeof(mock_rates[0]))];
+        r.delivery_system = i % 3 ? SYS_DVBS2 : SYS_DVBS;
+        r.inversion = INVERSION_AUTO;
+        r.pilot = i % 2 ? PILOT_ON : PILOT_OFF;
+        r.fec_inner = FEC_1_2 + i % 8;
+        r.modulation = i % 3 ? PSK_8 : QPSK;
+        r.rolloff = ROLLOFF_35;
+        r.pls_mode = 0;
+        r.is_id = -1;
+        r.pls_code = 0;
+        r.t2mi_plp_id = -1;
+        r.t2mi_pid = 0;
+        len += format_raw(buf + len, count - len, i, &r);
+    }
+
+    return len < count ? (ssize_t)len : (ssize_t)count;
+}
+
+static bool mock_wait(struct bs_session *session, int timeout_ms)
+{
+    (void)session;
+    (void)timeout_ms;
+
+    return true;
+}
+
+/* The synthetic spectrum has energy in every third 100 MHz block of IF. */
+static bool mock_power(struct bs_session *session, uint32_t if_mhz, int64_t *level)
+{
+    (void)session;
+
+    if (mock_trace.seg)
+        return false;
+
+    mock_delay(session);
+    *level = (if_mhz / 100) % 3 ? -60000 : -45000;
+
+    return true;
+}
+
+static const struct bs_backend mock_backend = {
+    .open = mock_open,
+    .close = mock_close,
+    .ctrl_read = mock_ctrl_read,
+    .ctrl_write = mock_ctrl_write,
+    .info_read = mock_info_read,
+    .info_write = mock_info_write,
+    .wait = mock_wait,
+    .power = mock_power,
+};
+
+static void bs_session_release(struct bs_session *session)
+{
+    if (session->user_band < 0)
+        return;
+
+    pthread_mutex_lock(&lnb_lock);
+    user_band_busy[session->user_band] = false;
+    pthread_mutex_unlock(&lnb_lock);
+    session->user_band = -1;
+}
+
+static int bs_session_open(struct bs_session *session, int fe_id, int slot_id)
+{
+    session->backend = backend;
+    session->priv = NULL;
+    session->fe_id = fe_id;
+    session->slot = slot_id;
+    session->lock_fd = -1;
+    session->ctrl_fd = -1;
+    session->info_fd = -1;
+    session->ctrl_pollable = true;
+    session->ctrl_spurious = 0;
+    session->info_bulk = BULK_UNKNOWN;
+    session->syscalls = 0;
+    session->io_us = 0;
+    session->io_calls = 0;
+    session->swept_mhz = 0;
+    session->transponders = 0;
+    session->dvb_fd = -1;
+    session->lnb_valid = false;
+    session->user_band = -1;
+    session->if_base_khz = 0;
+    session->checkpoint = NULL;
+
+    if (lnb.num_user_bands)
+    {
+        pthread_mutex_lock(&lnb_lock);
+        for (int i = 0; i < lnb.num_user_bands && session->user_band < 0; i++)
+        {
+            if (!user_band_busy[i])
+            {
+                user_band_busy[i] = true;
+                session->user_band = i;
+            }
+        }
+        pthread_mutex_unlock(&lnb_lock);
+
+        /* Every tuner on the cable needs a user band of its own. */
+        if (session->user_band < 0)
+            return -1;
+    }
+
+    if (session->backend->open(session) < 0)
+    {
+        bs_session_release(session);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Give the DVB frontend back, the next job sets up the LNB from scratch. */
+static void lnb_release(struct bs_session *session)
+{
+    if (session->dvb_fd >= 0)
+        close(session->dvb_fd);
+    session->dvb_fd = -1;
+    session->lnb_valid = false;
+}
+
+static void bs_session_close(struct bs_session *session)
+{
+    lnb_release(session);
+    bs_session_release(session);
+
+    session->backend->close(session);
+    stats_syscalls(session->syscalls);
+}
+
+static bool bs_session_wait(struct bs_session *session, int timeout_ms)
+{
+    return session->backend->wait(session, timeout_ms);
+}
+
+/* Append the lines of a driver response to the --record trace. */
+static void record_lines(char kind, const char *buf, ssize_t len)
+{
+    uint64_t ts = now_us() - stats_start_us;
+    const char *end;
+
+    flockfile(record_fp);
+
+    while (len > 0)
+    {
+        end = memchr(buf, '\n', len);
+        if (end == NULL)
+            end = buf + len;
+
+        if (end > buf)
+            fprintf(record_fp, "%" PRIu64 " %c %.*s\n", ts, kind, (int)(end - buf), buf);
+
+        len -= end - buf + 1;
+        buf = end + 1;
+    }
+
+    fflush(record_fp);
+    funlockfile(record_fp);
+}
+
+static ssize_t bs_ctrl_read(struct bs_session *session, char *buf, size_t count)
+{
+    uint64_t t = bench_begin();
+    ssize_t ret = session->backend->ctrl_read(session, buf, count);
+
+    bench_end(session, t);
+    if (record_fp && ret > 0)
+        record_lines('C', buf, ret);
+
+    return ret;
+}
+
+static ssize_t bs_ctrl_write(struct bs_session *session, const char *buf, size_t count)
+{
+    uint64_t t = bench_begin();
+    ssize_t ret;
+
+    if (record_fp && buf[0] != '0')
+        record_lines('S', buf, count);
+
+    ret = session->backend->ctrl_write(session, buf, count);
+    bench_end(session, t);
+
+    return ret;
+}
+
+static ssize_t bs_info_read(struct bs_session *session, char *buf, size_t count)
+{
+    uint64_t t = bench_begin();
+    ssize_t ret = session->backend->info_read(session, buf, count);
+
+    bench_end(session, t);
+    if (record_fp && ret > 0)
+        record_lines('I', buf, ret);
+
+    return ret;
+}
+
+static ssize_t bs_info_write(struct bs_session *session, const char *buf, size_t count)
+{
+    uint64_t t = bench_begin();
+    ssize_t ret = session->backend->info_write(session, buf, count);
+
+    bench_end(session, t);
+
+    return ret;
+}
+
+/* Poll less often while far from the end, faster as progress nears 100%. */
+static int status_poll_interval(uint64_t elapsed_us, int progress)
+{
+    uint64_t eta_ms;
+    int interval;
+
+    if (progress <= 0 || progress >= 100)
+        return STATUS_POLL_DEFAULT_MS;
+
+    eta_ms = elapsed_us * (100 - progress) / progress / 1000;
+    interval = eta_ms / 4 > STATUS_POLL_MAX_MS ? STATUS_POLL_MAX_MS : (int)(eta_ms / 4);
+    if (interval < STATUS_POLL_MIN_MS)
+        interval = STATUS_POLL_MIN_MS;
+
+    return interval;
+}
+
+static int bs_fetch(struct bs_session *session, int i, struct bs_result *r)
+{
+    char buf[BUFSIZ];
+    const char *p;
+    ssize_t ret;
+    uint64_t t;
+
+    sprintf(buf, "%d", i);
+    t = stats_begin();
+    ret = bs_info_write(session, buf, strlen(buf));
+    stats_end(STAT_INFO_WRITE, t);
+    if (ret < 0)
+        return -1;
+
+    t = stats_begin();
+    ret = bs_info_read(session, buf, sizeof(buf));
+    stats_end(STAT_INFO_READ, t);
+    if (ret < 0)
+        return -1;
+
+    p = buf;
+    if (bs_parse_result("bs_info", &p, buf + ret, r) < 0)
+        return -1;
+
+    if (i != r->index)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Request the records first...last with a single "<first> <last>" write.
+ * Drivers without range support only parse the first index and return a
+ * single record, which switches the session back to per-index retrieval.
+ * Returns the number of consecutive records stored in r.
+ */
+static int bs_fetch_bulk(struct bs_session *session, int first, int last, struct bs_result *r)
+{
+    char buf[BUFSIZ];
+    const char *p, *end;
+    ssize_t ret;
+    uint64_t t;
+    int n = 0;
+
+    sprintf(buf, "%d %d", first, last);
+    t = stats_begin();
+    ret = bs_info_write(session, buf, strlen(buf));
+    stats_end(STAT_INFO_WRITE, t);
+    if (ret < 0)
+    {
+        session->info_bulk = BULK_NO;
+        return 0;
+    }
+
+    t = stats_begin();
+    ret = bs_info_read(session, buf, sizeof(buf));
+    stats_end(STAT_INFO_READ, t);
+    if (ret < 0)
+        return 0;
+
+    p = buf;
+    end = buf + ret;
+    while (p < end && first + n <= last)
+    {
+        if (*p == '\n')
+        {
+            p++;
+            continue;
+        }
+
+        if (bs_parse_result("bs_info", &p, end, &r[n]) < 0 || r[n].index != first + n)
+            break;
+
+        n++;
+    }
+
+    if (session->info_bulk == BULK_UNKNOWN)
+        session->info_bulk = n > 1 ? BULK_YES : BULK_NO;
+
+    return n;
+}
+
+static void *output_main(void *arg)
+{
+    struct output_ring *o = arg;
+    struct iovec iov[2];
+    struct timespec ts;
+    ssize_t n;
+
+    pthread_mutex_lock(&o->lock);
+
+    for (;;)
+    {
+        if (!o->len && !o->closing)
+        {
+            pthread_cond_wait(&o->cond, &o->lock);
+            continue;
+        }
+
+        if (!o->line && !o->closing && o->len < OUTPUT_BATCH)
+        {
+            /* Let a batch build up, but no longer than the flush interval. */
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += OUTPUT_FLUSH_MS * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+
+            while (!o->closing && o->len < OUTPUT_BATCH &&
+                   pthread_cond_timedwait(&o->cond, &o->lock, &ts) != ETIMEDOUT)
+                ;
+        }
+
+        if (!o->len)
+            break;
+
+        iov[0].iov_base = o->buf + o->head;
+        iov[0].iov_len = o->head + o->len > OUTPUT_RING_SIZE ? OUTPUT_RING_SIZE - o->head : o->len;
+        iov[1].iov_base = o->buf;
+        iov[1].iov_len = o->len - iov[0].iov_len;
+
+        pthread_mutex_unlock(&o->lock);
+        n = writev(o->fd, iov, iov[1].iov_len ? 2 : 1);
+        pthread_mutex_lock(&o->lock);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0)
+        {
+            /* The consumer went away, drop what it would have read. */
+            o->failed = true;
+            n = o->len;
+        }
+
+        o->head = (o->head + n) % OUTPUT_RING_SIZE;
+        o->len -= n;
+        o->writes++;
+        o->bytes += n;
+        pthread_cond_broadcast(&o->space);
+    }
+
+    pthread_mutex_unlock(&o->lock);
+
+    return NULL;
+}
+
+/* Copy size bytes to the ring, waiting only while it is full. */
+static ssize_t output_write(void *cookie, const char *buf, size_t size)
+{
+    struct output_ring *o = cookie;
+    size_t left = size;
+    size_t n, tail;
+    bool empty;
+
+    pthread_mutex_lock(&o->lock);
+
+    empty = !o->len;
+
+    while (left && !o->failed)
+    {
+        if (o->len == OUTPUT_RING_SIZE)
+        {
+            o->stalls++;
+            pthread_cond_signal(&o->cond);
+            pthread_cond_wait(&o->space, &o->lock);
+            continue;
+        }
+
+        tail = (o->head + o->len) % OUTPUT_RING_SIZE;
+        n = tail >= o->head ? OUTPUT_RING_SIZE - tail : o->head - tail;
+        if (n > left)
+            n = left;
+
+        memcpy(o->buf + tail, buf, n);
+        o->len += n;
+        buf += n;
+        left -= n;
+    }
+
+    /* The first record of a batch starts the flush interval. */
+    if (o->line || empty || o->len >= OUTPUT_BATCH)
+        pthread_cond_signal(&o->cond);
+
+    pthread_mutex_unlock(&o->lock);
+
+    return o->failed ? -1 : (ssize_t)size;
+}
+
+static int output_close(void *cookie)
+{
+    struct output_ring *o = cookie;
+
+    pthread_mutex_lock(&o->lock);
+    o->closing = true;
+    pthread_cond_signal(&o->cond);
+    pthread_mutex_unlock(&o->lock);
+
+    pthread_join(o->thread, NULL);
+
+    if (stats_enabled)
+        fprintf(stderr, "STATS output_writes=%" PRIu64 " output_bytes=%" PRIu64 " output_stalls=%" PRIu64 "\n",
+                o->writes, o->bytes, o->stalls);
+
+    if (o->fd != STDOUT_FILENO)
+        close(o->fd);
+    free(o->buf);
+    free(o);
+
+    return 0;
+}
+
+static int output_connect(const char *dest)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    struct addrinfo hints = {.ai_socktype = SOCK_STREAM};
+    struct addrinfo *res, *ai;
+    char host[256];
+    const char *port;
+    int fd = -1;
+
+    if (!strcmp(dest, "-"))
+        return STDOUT_FILENO;
+
+    if (!strncmp(dest, "unix:", 5))
+    {
+        if (strlen(dest + 5) >= sizeof(addr.sun_path))
+            return -1;
+
+        strcpy(addr.sun_path, dest + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+        {
+            close(fd);
+            fd = -1;
+        }
+
+        return fd;
+    }
+
+    if (strncmp(dest, "tcp:", 4))
+        return open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    port = strrchr(dest + 4, ':');
+    if (port == NULL || (size_t)(port - dest - 4) >= sizeof(host))
+        return -1;
+
+    memcpy(host, dest + 4, port - dest - 4);
+    host[port - dest - 4] = '\0';
+
+    if (getaddrinfo(host, port + 1, &hints, &res))
+        return -1;
+
+    for (ai = res; ai && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+/*
+ * Open --output as a stdio stream whose writes land in the ring buffer, so
+ * the print functions and their fflush() never wait for the consumer. Only
+ * a full ring holds them up. Terminals are line flushed.
+ */
+static FILE *output_open(const char *dest)
+{
+    cookie_io_functions_t io = {
+        .write = output_write,
+        .close = output_close,
+    };
+    struct output_ring *o;
+    FILE *fp;
+
+    o = calloc(1, sizeof(*o));
+    if (o == NULL)
+        return NULL;
+
+    o->buf = malloc(OUTPUT_RING_SIZE);
+    o->fd = output_connect(dest);
+    if (o->buf == NULL || o->fd < 0)
+    {
+        free(o->buf);
+        free(o);
+        return NULL;
+    }
+
+    o->line = output_line || isatty(o->fd);
+    pthread_mutex_init(&o->lock, NULL);
+    pthread_cond_init(&o->cond, NULL);
+    pthread_cond_init(&o->space, NULL);
+
+    if (pthread_create(&o->thread, NULL, output_main, o))
+    {
+        close(o->fd);
+        free(o->buf);
+        free(o);
+        return NULL;
+    }
+
+    fp = fopencookie(o, "w", io);
+    if (fp == NULL)
+    {
+        output_close(o);
+        return NULL;
+    }
+
+    return fp;
+}
+
+static uint32_t lnb_frequency(const struct scan_job *job, uint32_t frequency)
+{
+    if (job->band == BAND_CBAND)
+        return lnb.lo_cband_khz - frequency;
+    else if (job->band == BAND_HIGH)
+        return frequency + lnb.lo_high_khz;
+    else
+        return frequency + lnb.lo_low_khz;
+}
+
+static char *append(char *p, const struct name *n)
+{
+    *p++ = ' ';
+    memcpy(p, n->s, n->len);
+
+    return p + n->len;
+}
+
+static char *append_digits(char *p, uint32_t val)
+{
+    char tmp[10];
+    int n = 0;
+
+    do
+    {
+        tmp[n++] = '0' + val % 10;
+        val /= 10;
+    } while (val);
+
+    while (n)
+        *p++ = tmp[--n];
+
+    return p;
+}
+
+static char *append_uint(char *p, uint32_t val)
+{
+    *p++ = ' ';
+
+    return append_digits(p, val);
+}
+
+static char *append_int(char *p, int val)
+{
+    *p++ = ' ';
+
+    if (val < 0)
+    {
+        *p++ = '-';
+        return append_digits(p, -(uint32_t)val);
+    }
+
+    return append_digits(p, val);
+}
+
+static void print_text(const struct bs_result *r, int slot_id, const struct scan_job *job,
+                       const struct bs_verify *v)
+{
+    char buf[256];
+    char *p = buf;
+
+    memcpy(p, "OK", 2);
+    p += 2;
+
+    if (tag_slots)
+    {
+        memcpy(p, " SLOT_", 6);
+        p = append_digits(p + 6, slot_id);
+    }
+
+    if (job->diseqc != DISEQC_NONE)
+    {
+        const struct name *tag = &diseqc_tags[DISEQC_KIND(job->diseqc)];
+
+        memcpy(p, tag->s, tag->len);
+        p = append_digits(p + tag->len, DISEQC_PORT(job->diseqc));
+    }
+
+    p = append(p, &polarization_names[job->vertical]);
+    p = append_uint(p, lnb_frequency(job, ((r->frequency + 500) / 1000) * 1000));
+    p = append_uint(p, ((r->symbol_rate + 500) / 1000) * 1000);
+    p = append(p, NAME_LOOKUP(delivery_system_names, r->delivery_system, SYS_DVBS2));
+    p = append(p, NAME_LOOKUP(inversion_names, r->inversion, INVERSION_AUTO));
+    p = append(p, NAME_LOOKUP(pilot_names, r->pilot, PILOT_AUTO));
+    p = append(p, NAME_LOOKUP(fec_names, r->fec_inner, FEC_AUTO));
+    p = append(p, NAME_LOOKUP(modulation_names, r->modulation, QPSK));
+    p = append(p, NAME_LOOKUP(rolloff_names, r->rolloff, ROLLOFF_35));
+    p = append_int(p, r->pls_mode);
+    p = append_int(p, r->is_id);
+    p = append_int(p, r->pls_code);
+
+    if (r->t2mi_plp_id != -1)
+    {
+        p = append_int(p, r->t2mi_plp_id);
+        p = append_int(p, r->t2mi_pid);
+    }
+
+    if (v && !v->verified)
+    {
+        p += sprintf(p, " UNVERIFIED");
+    }
+    else if (v)
+    {
+        p += sprintf(p, v->locked ? " LOCKED" : " NOLOCK");
+        if (v->has_cnr)
+            p += sprintf(p, " snr=%.1f", v->cnr / 1000.0);
+        if (v->has_ber)
+            p += sprintf(p, " ber=%.2e", v->ber);
+    }
+
+    *p++ = '\n';
+
+    fwrite(buf, p - buf, 1, job->out);
+    fflush(job->out);
+}
+
+static void print_json(const struct bs_result *r, int slot_id, const struct scan_job *job,
+                       const struct bs_verify *v)
+{
+    char extra[128] = "";
+    int n = 0;
+
+    if (job->diseqc != DISEQC_NONE)
+        n += sprintf(extra, ",\"diseqc\":\"%s:%d\"",
+                     diseqc_names[DISEQC_KIND(job->diseqc)].s, DISEQC_PORT(job->diseqc));
+
+    if (v && !v->verified)
+    {
+        sprintf(extra + n, ",\"verified\":false");
+    }
+    else if (v)
+    {
+        n += sprintf(extra + n, ",\"locked\":%s", v->locked ? "true" : "false");
+        if (v->has_cnr)
+            n += sprintf(extra + n, ",\"snr\":%.1f", v->cnr / 1000.0);
+        if (v->has_ber)
+            sprintf(extra + n, ",\"ber\":%.2e", v->ber);
+    }
+
+    fprintf(job->out, "{\"slot\":%d,\"polarization\":\"%s\",\"band\":\"%s\","
+                    "\"frequency\":%u,\"lnb_frequency\":%u,\"symbol_rate\":%u,"
+                    "\"delivery_system\":%d,\"inversion\":%d,\"pilot\":%d,"
+                    "\"fec_inner\":%d,\"modulation\":%d,\"rolloff\":%d,"
+                    "\"pls_mode\":%d,\"is_id\":%d,\"pls_code\":%d,"
+                    "\"t2mi_plp_id\":%d,\"t2mi_pid\":%d%s}\n",
+            slot_id, job->vertical ? "V" : "H", band_names[job->band].s,
+            r->frequency, lnb_frequency(job, r->frequency), r->symbol_rate,
+            r->delivery_system, r->inversion, r->pilot,
+            r->fec_inner, r->modulation, r->rolloff,
+            r->pls_mode, r->is_id, r->pls_code,
+            r->t2mi_plp_id, r->t2mi_pid, extra);
+    fflush(job->out);
+}
+
+static void print_binary(const struct bs_result *r, int slot_id, const struct scan_job *job)
+{
+    struct bs_record rec = {
+        .length = sizeof(rec),
+        .version = BS_RECORD_VERSION,
+        .slot = slot_id,
+        .vertical = job->vertical,
+        .band = job->band,
+        .diseqc = job->diseqc,
+        .frequency = r->frequency,
+        .lnb_frequency = lnb_frequency(job, r->frequency),
+        .symbol_rate = r->symbol_rate,
+        .delivery_system = r->delivery_system,
+        .inversion = r->inversion,
+        .pilot = r->pilot,
+        .fec_inner = r->fec_inner,
+        .modulation = r->modulation,
+        .rolloff = r->rolloff,
+        .pls_mode = r->pls_mode,
+        .is_id = r->is_id,
+        .pls_code = r->pls_code,
+        .t2mi_plp_id = r->t2mi_plp_id,
+        .t2mi_pid = r->t2mi_pid,
+    };
+
+    fwrite(&rec, sizeof(rec), 1, job->out);
+    fflush(job->out);
+}
+
+static void print_result(const struct bs_result *r, int slot_id, const struct scan_job *job,
+                         const struct bs_verify *v)
+{
+    switch (format)
+    {
+    case FORMAT_JSON:
+        print_json(r, slot_id, job, v);
+        break;
+    case FORMAT_BINARY:
+        print_binary(r, slot_id, job);
+        break;
+    default:
+        print_text(r, slot_id, job, v);
+        break;
+    }
+}
+
+/*
+ * Overlapping sub-bands report the same carrier twice with slightly different
+ * values. Treat results on the same polarity and band whose centres are less
+ * than half a symbol rate apart as one transponder.
+ */
+static int64_t merged_cmp(const struct merged_result *e, const struct scan_job *job, uint32_t frequency)
+{
+    if (e->job.slot != job->slot)
+        return e->job.slot - job->slot;
+    if (e->job.diseqc != job->diseqc)
+        return e->job.diseqc - job->diseqc;
+    if (e->job.vertical != job->vertical)
+        return e->job.vertical - job->vertical;
+    if (e->job.band != job->band)
+        return e->job.band - job->band;
+
+    return (int64_t)e->r.frequency - frequency;
+}
+
+/* Index of the first entry not ordered before job/frequency. */
+static int merged_lower_bound(const struct scan_job *job, uint32_t frequency)
+{
+    int lo = 0, hi = merged.num;
+
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+
+        if (merged_cmp(&merged.e[mid], job, frequency) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * Return the entry within half a symbol rate of r, the tolerance scans of
+ * the same carrier fall into, or NULL. The nearest one wins.
+ */
+static struct merged_result *merged_find(const struct scan_job *job, const struct bs_result *r)
+{
+    struct merged_result *best = NULL;
+    uint32_t tolerance = merged.max_symbol_rate > r->symbol_rate ? merged.max_symbol_rate : r->symbol_rate;
+    uint32_t low = r->frequency > tolerance / 2000 ? r->frequency - tolerance / 2000 : 0;
+    int64_t best_df = INT64_MAX;
+
+    for (int i = merged_lower_bound(job, low); i < merged.num; i++)
+    {
+        struct merged_result *e = &merged.e[i];
+        uint32_t sr = e->r.symbol_rate > r->symbol_rate ? e->r.symbol_rate : r->symbol_rate;
+        int64_t df = (int64_t)e->r.frequency - r->frequency;
+
+        if (e->job.slot != job->slot || e->job.diseqc != job->diseqc || e->job.vertical != job->vertical ||
+            e->job.band != job->band ||
+            df > tolerance / 2000)
+            break;
+
+        if (df < 0)
+            df = -df;
+
+        if (df < sr / 2000 && df < best_df)
+        {
+            best = e;
+            best_df = df;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Carriers cut by the edge of the swept range are the least reliable, then
+ * those with parameters the driver could not determine.
+ */
+static int result_quality(const struct scan_job *job, const struct bs_result *r)
+{
+    int64_t start = (int64_t)job->start_frequency_mhz * 1000;
+    int64_t stop = (int64_t)job->stop_frequency_mhz * 1000;
+    int64_t half = (int64_t)r->symbol_rate * 135 / 200000;
+    int quality = 0;
+
+    if (r->frequency - half >= start && r->frequency + half <= stop)
+        quality += 8;
+    if (r->fec_inner != FEC_AUTO)
+        quality++;
+    if (r->inversion != INVERSION_AUTO)
+        quality++;
+    if (r->pilot != PILOT_AUTO)
+        quality++;
+    if (r->rolloff != ROLLOFF_AUTO)
+        quality++;
+
+    return quality;
+}
+
+static void merged_insert(int slot, const struct scan_job *job, const struct bs_result *r, int quality)
+{
+    struct merged_result *e;
+    int i;
+
+    if (merged.num == merged.size)
+    {
+        int size = merged.size ? merged.size * 2 : 256;
+
+        e = realloc(merged.e, size * sizeof(*e));
+        if (e == NULL)
+            return;
+
+        merged.e = e;
+        merged.size = size;
+    }
+
+    i = merged_lower_bound(job, r->frequency);
+    e = &merged.e[i];
+    memmove(e + 1, e, (merged.num - i) * sizeof(*e));
+    merged.num++;
+
+    e->slot = slot;
+    e->quality = quality;
+    e->job = *job;
+    e->r = *r;
+    if (r->symbol_rate > merged.max_symbol_rate)
+        merged.max_symbol_rate = r->symbol_rate;
+}
+
+/*
+ * Add r to the merge index. Returns true if it duplicates an earlier result,
+ * in which case the better of the two is kept.
+ */
+static bool result_merge(int slot, const struct scan_job *job, const struct bs_result *r)
+{
+    struct merged_result *e;
+    int quality;
+    bool dup;
+
+    if (!split_mhz && !merge && !lnb.num_user_bands)
+        return false;
+
+    quality = result_quality(job, r);
+
+    pthread_mutex_lock(&merged_lock);
+
+    e = merged_find(job, r);
+    dup = e != NULL;
+    if (e && quality > e->quality)
+    {
+        /* The replacement may sort elsewhere within the tolerance. */
+        memmove(e, e + 1, (merged.num - (e - merged.e) - 1) * sizeof(*e));
+        merged.num--;
+        e = NULL;
+    }
+
+    if (e == NULL)
+        merged_insert(slot, job, r, quality);
+
+    pthread_mutex_unlock(&merged_lock);
+
+    return dup;
+}
+
+static void verify_push(int slot_id, const struct scan_job *job, const struct bs_result *r)
+{
+    struct verify_item **q;
+    struct verify_item *item;
+
+    item = malloc(sizeof(*item));
+    if (item == NULL)
+        return;
+
+    item->slot = slot_id;
+    item->job = *job;
+    item->r = *r;
+
+    pthread_mutex_lock(&verify_lock);
+
+    q = realloc(verify_queue, (num_verify + 1) * sizeof(*q));
+    if (q)
+    {
+        verify_queue = q;
+        verify_queue[num_verify++] = item;
+        pthread_cond_signal(&verify_cond);
+    }
+    else
+    {
+        free(item);
+    }
+
+    pthread_mutex_unlock(&verify_lock);
+}
+
+/* Print r now, or hand it to the verifying tuner which prints it once tuned. */
+static void output_result(const struct bs_result *r, int slot_id, const struct scan_job *job)
+{
+    uint64_t t;
+
+    if (verify_running)
+    {
+        verify_push(slot_id, job, r);
+        return;
+    }
+
+    t = stats_begin();
+    print_result(r, slot_id, job, NULL);
+    stats_end(STAT_FORMAT, t);
+    stats_result();
+}
+
+/* Print the merged transponders in index order. */
+static void merged_flush(void)
+{
+    if (!merge)
+        return;
+
+    for (int i = 0; i < merged.num; i++)
+        output_result(&merged.e[i].r, merged.e[i].slot, &merged.e[i].job);
+}
+
+static void result_list_add(struct result_list *list, const struct bs_result *r)
+{
+    struct bs_result *e;
+
+    e = realloc(list->r, (list->num + 1) * sizeof(*list->r));
+    if (e == NULL)
+        return;
+
+    list->r = e;
+    list->r[list->num++] = *r;
+}
+
+static void result_save(FILE *fp, int index, const struct bs_result *r)
+{
+    fprintf(fp, "%d %u %u %d %d %d %d %d %d %d %d %d %d %d\n",
+            index, r->frequency, r->symbol_rate, r->delivery_system,
+            r->inversion, r->pilot, r->fec_inner, r->modulation,
+            r->rolloff, r->pls_mode, r->is_id, r->pls_code,
+            r->t2mi_plp_id, r->t2mi_pid);
+}
+
+/* Sync the temporary file fp to disk and move it over filename. */
+static int file_commit(FILE *fp, const char *tmpname, const char *filename)
+{
+    if (fflush(fp) || fsync(fileno(fp)))
+    {
+        fclose(fp);
+        unlink(tmpname);
+        return -1;
+    }
+
+    fclose(fp);
+
+    if (rename(tmpname, filename))
+    {
+        unlink(tmpname);
+        return -1;
+    }
+
+    return 0;
+}
+
+static bool checkpoint_match(const struct scan_job *a, const struct scan_job *b)
+{
+    return a->slot == b->slot && a->diseqc == b->diseqc && a->vertical == b->vertical && a->band == b->band &&
+           a->start_frequency_mhz == b->start_frequency_mhz && a->stop_frequency_mhz == b->stop_frequency_mhz &&
+           a->symbolrate_min_mhz == b->symbolrate_min_mhz && a->symbolrate_max_mhz == b->symbolrate_max_mhz;
+}
+
+/* Called with checkpoint_lock held. */
+static struct checkpoint *checkpoint_add(const struct scan_job *job)
+{
+    struct checkpoint **list;
+    struct checkpoint *cp;
+
+    for (int i = 0; i < num_checkpoints; i++)
+    {
+        if (checkpoint_match(&checkpoints[i]->job, job))
+            return checkpoints[i];
+    }
+
+    cp = calloc(1, sizeof(*cp));
+    list = realloc(checkpoints, (num_checkpoints + 1) * sizeof(*checkpoints));
+    if (cp == NULL || list == NULL)
+    {
+        free(cp);
+        if (list)
+            checkpoints = list;
+        return NULL;
+    }
+
+    cp->job = *job;
+    cp->job.out = NULL;
+    cp->partial_first = INT_MAX;
+
+    checkpoints = list;
+    checkpoints[num_checkpoints++] = cp;
+
+    return cp;
+}
+
+static struct checkpoint *checkpoint_get(const struct scan_job *job)
+{
+    struct checkpoint *cp;
+
+    if (checkpoint_path == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&checkpoint_lock);
+    cp = checkpoint_add(job);
+    pthread_mutex_unlock(&checkpoint_lock);
+
+    return cp;
+}
+
+/* Add sw to the sweeps done, joining it with those it overlaps or touches. */
+static bool checkpoint_add_sweep(struct checkpoint *cp, const struct sweep *sw)
+{
+    struct sweep s = *sw;
+    struct sweep *done;
+
+    if (s.stop_mhz <= s.start_mhz)
+        return true;
+
+    done = realloc(cp->done, (cp->num_done + 1) * sizeof(*done));
+    if (done == NULL)
+        return false;
+
+    cp->done = done;
+
+    for (int i = 0; i < cp->num_done; i++)
+    {
+        const struct sweep *d = &cp->done[i];
+
+        if (d->sr_min_mhz != s.sr_min_mhz || d->sr_max_mhz != s.sr_max_mhz ||
+            d->stop_mhz < s.start_mhz || d->start_mhz > s.stop_mhz)
+            continue;
+
+        if (d->start_mhz < s.start_mhz)
+            s.start_mhz = d->start_mhz;
+        if (d->stop_mhz > s.stop_mhz)
+            s.stop_mhz = d->stop_mhz;
+
+        cp->done[i--] = cp->done[--cp->num_done];
+    }
+
+    cp->done[cp->num_done++] = s;
+
+    return true;
+}
+
+/*
+ * Narrow *start_mhz...*stop_mhz to its first part not swept yet for
+ * sr_min_mhz...sr_max_mhz. Returns false if all of it has been.
+ */
+static bool checkpoint_next(const struct checkpoint *cp, uint32_t *start_mhz, uint32_t *stop_mhz,
+                            uint32_t sr_min_mhz, uint32_t sr_max_mhz)
+{
+    bool moved = true;
+
+    while (moved)
+    {
+        moved = false;
+        for (int i = 0; i < cp->num_done; i++)
+        {
+            const struct sweep *d = &cp->done[i];
+
+            if (d->sr_min_mhz == sr_min_mhz && d->sr_max_mhz == sr_max_mhz &&
+                d->start_mhz <= *start_mhz && d->stop_mhz > *start_mhz)
+            {
+                *start_mhz = d->stop_mhz;
+                moved = true;
+            }
+        }
+    }
+
+    if (*start_mhz >= *stop_mhz)
+        return false;
+
+    for (int i = 0; i < cp->num_done; i++)
+    {
+        const struct sweep *d = &cp->done[i];
+
+        if (d->sr_min_mhz == sr_min_mhz && d->sr_max_mhz == sr_max_mhz &&
+            d->start_mhz > *start_mhz && d->start_mhz < *stop_mhz)
+            *stop_mhz = d->start_mhz;
+    }
+
+    return true;
+}
+
+static bool checkpoint_saved(const struct checkpoint *cp, int i)
+{
+    return i < cp->partial_first || cp->found.r[i].frequency < cp->partial.stop_mhz * 1000;
+}
+
+/* Write the state of all jobs to the --checkpoint file. Called with checkpoint_lock held. */
+static int checkpoint_save(void)
+{
+    char tmpname[PATH_MAX + 4];
+    FILE *fp;
+
+    checkpoint_us = now_us();
+
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", checkpoint_path);
+
+    fp = fopen(tmpname, "w");
+    if (fp == NULL)
+        return -1;
+
+    for (int i = 0; i < num_checkpoints; i++)
+    {
+        const struct checkpoint *cp = checkpoints[i];
+        const struct scan_job *job = &cp->job;
+
+        fprintf(fp, "JOB %d %d %d %d %u %u %u %u %d %d\n",
+                job->slot, job->diseqc, job->vertical, job->band,
+                job->start_frequency_mhz, job->stop_frequency_mhz,
+                job->symbolrate_min_mhz, job->symbolrate_max_mhz,
+                cp->gaps, cp->complete);
+
+        for (int j = 0; j <= cp->num_done; j++)
+        {
+            const struct sweep *d = j < cp->num_done ? &cp->done[j] : &cp->partial;
+
+            if (d->stop_mhz > d->start_mhz)
+                fprintf(fp, "DONE %u %u %u %u\n", d->start_mhz, d->stop_mhz, d->sr_min_mhz, d->sr_max_mhz);
+        }
+
+        for (int j = 0; j < cp->found.num; j++)
+        {
+            if (checkpoint_saved(cp, j))
+                result_save(fp, j, &cp->found.r[j]);
+        }
+    }
+
+    return file_commit(fp, tmpname, checkpoint_path);
+}
+
+/*
+ * Load the --checkpoint file of an interrupted scan. A missing file leaves
+ * nothing to resume, so the scan starts from scratch.
+ */
+static int checkpoint_load(const char *filename)
+{
+    struct checkpoint *cp = NULL;
+    struct scan_job job;
+    struct sweep sw;
+    struct bs_result r;
+    FILE *fp;
+    char *line = NULL;
+    const char *p;
+    size_t len = 0;
+    ssize_t n;
+    int vert, gaps, complete;
+    int lineno = 0;
+    char what[PATH_MAX + 16];
+    bool ok = true;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    while (ok && (n = getline(&line, &len, fp)) != -1)
+    {
+        lineno++;
+        snprintf(what, sizeof(what), "%s:%d", filename, lineno);
+
+        memset(&job, 0, sizeof(job));
+        if (sscanf(line, "JOB %d %d %d %d %u %u %u %u %d %d",
+                   &job.slot, &job.diseqc, &vert, &job.band,
+                   &job.start_frequency_mhz, &job.stop_frequency_mhz,
+                   &job.symbolrate_min_mhz, &job.symbolrate_max_mhz,
+                   &gaps, &complete) == 10 && job.band >= 0 && job.band <= BAND_CBAND)
+        {
+            job.vertical = vert;
+            cp = checkpoint_add(&job);
+            if (cp == NULL)
+            {
+                ok = false;
+                break;
+            }
+            cp->gaps = gaps;
+            cp->complete = complete;
+            continue;
+        }
+
+        if (cp == NULL)
+        {
+            fprintf(stderr, "ERROR %s line=\"%.*s\"\n", what, (int)strcspn(line, "\n"), line);
+            ok = false;
+            break;
+        }
+
+        if (sscanf(line, "DONE %u %u %u %u", &sw.start_mhz, &sw.stop_mhz, &sw.sr_min_mhz, &sw.sr_max_mhz) == 4)
+        {
+            ok = checkpoint_add_sweep(cp, &sw);
+            continue;
+        }
+
+        p = line;
+        if (bs_parse_result(what, &p, line + n, &r) < 0)
+        {
+            ok = false;
+            break;
+        }
+
+        result_list_add(&cp->found, &r);
+    }
+
+    free(line);
+    fclose(fp);
+
+    return ok ? 0 : -1;
+}
+
+static void checkpoint_result(struct bs_session *session, const struct bs_result *r)
+{
+    pthread_mutex_lock(&checkpoint_lock);
+    result_list_add(&session->checkpoint->found, r);
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+/*
+ * Start a sweep from start_mhz. What a failed sweep before it completed is
+ * kept, what it found beyond is left for the scan to find again.
+ */
+static void checkpoint_begin(struct bs_session *session, uint32_t start_mhz,
+                             uint32_t sr_min_mhz, uint32_t sr_max_mhz)
+{
+    struct checkpoint *cp = session->checkpoint;
+    int num = cp->partial_first;
+
+    pthread_mutex_lock(&checkpoint_lock);
+
+    if (cp->partial_first != INT_MAX)
+    {
+        for (int i = cp->partial_first; i < cp->found.num; i++)
+        {
+            if (checkpoint_saved(cp, i))
+                cp->found.r[num++] = cp->found.r[i];
+        }
+        cp->found.num = num;
+        checkpoint_add_sweep(cp, &cp->partial);
+    }
+
+    cp->partial.start_mhz = start_mhz;
+    cp->partial.stop_mhz = start_mhz;
+    cp->partial.sr_min_mhz = sr_min_mhz;
+    cp->partial.sr_max_mhz = sr_max_mhz;
+    cp->partial_first = cp->found.num;
+
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+/*
+ * The sweep in progress has found every carrier below frontier_mhz. Save
+ * that at most every CHECKPOINT_INTERVAL_MS unless forced.
+ */
+static void checkpoint_frontier(struct bs_session *session, uint32_t frontier_mhz, bool force)
+{
+    struct checkpoint *cp = session->checkpoint;
+
+    pthread_mutex_lock(&checkpoint_lock);
+
+    if (frontier_mhz > cp->partial.stop_mhz)
+        cp->partial.stop_mhz = frontier_mhz;
+
+    if (force || now_us() - checkpoint_us >= (uint64_t)CHECKPOINT_INTERVAL_MS * 1000)
+        checkpoint_save();
+
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+static void checkpoint_end(struct bs_session *session, uint32_t stop_mhz)
+{
+    struct checkpoint *cp = session->checkpoint;
+
+    pthread_mutex_lock(&checkpoint_lock);
+
+    cp->partial.stop_mhz = stop_mhz;
+    checkpoint_add_sweep(cp, &cp->partial);
+    memset(&cp->partial, 0, sizeof(cp->partial));
+    cp->partial_first = INT_MAX;
+    checkpoint_save();
+
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+static void checkpoint_finish(struct checkpoint *cp, bool gaps, bool complete)
+{
+    pthread_mutex_lock(&checkpoint_lock);
+
+    cp->gaps = gaps;
+    cp->complete = complete;
+    checkpoint_save();
+
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+static void checkpoint_free(void)
+{
+    for (int i = 0; i < num_checkpoints; i++)
+    {
+        free(checkpoints[i]->done);
+        free(checkpoints[i]->found.r);
+        free(checkpoints[i]);
+    }
+
+    free(checkpoints);
+}
+
+/*
+ * Frequency below which a sweep of start_mhz...stop_mhz at progress percent
+ * has reported every carrier, less half the bandwidth of the widest one.
+ */
+static uint32_t sweep_frontier(uint32_t start_mhz, uint32_t stop_mhz, uint32_t sr_max_mhz, int progress)
+{
+    uint32_t pad = sr_max_mhz * 135 / 200 + 1;
+    uint32_t f;
+
+    if (progress <= 0 || stop_mhz <= start_mhz)
+        return start_mhz;
+
+    f = start_mhz + (uint32_t)((uint64_t)(stop_mhz - start_mhz) * progress / 100);
+
+    return f > start_mhz + pad ? f - pad : start_mhz;
+}
+
+static void emit_result(struct bs_session *session, const struct scan_job *job,
+                        const struct bs_result *res, struct result_list *found)
+{
+    struct bs_result translated;
+    const struct bs_result *r = res;
+
+    if (session->if_base_khz)
+    {
+        translated = *res;
+        translated.frequency = session->if_base_khz - res->frequency;
+        r = &translated;
+    }
+
+    session->transponders++;
+    if (session->checkpoint)
+        checkpoint_result(session, r);
+
+    if (result_merge(session->slot, job, r))
+        return;
+
+    if (found)
+        result_list_add(found, r);
+
+    if (!merge)
+        output_result(r, session->slot, job);
+}
+
+static void fetch_results(struct bs_session *session, const struct scan_job *job,
+                          int *fetched, int num_info, struct result_list *found, bool drain)
+{
+    struct bs_result r[BULK_MAX];
+    int n;
+
+    while (*fetched < num_info && (drain || !signal_status))
+    {
+        if (session->info_bulk != BULK_NO && num_info - *fetched > 1)
+        {
+            int last = *fetched + BULK_MAX - 1;
+
+            if (last >= num_info)
+                last = num_info - 1;
+
+            n = bs_fetch_bulk(session, *fetched, last, r);
+            for (int i = 0; i < n; i++)
+                emit_result(session, job, &r[i], found);
+
+            *fetched += n;
+            if (n)
+                continue;
+        }
+
+        if (bs_fetch(session, *fetched, &r[0]) == 0)
+            emit_result(session, job, &r[0], found);
+
+        (*fetched)++;
+    }
+}
+
+static void print_progress(const struct bs_session *session, uint32_t start_mhz, uint32_t stop_mhz,
+                           int progress, int num_info, uint64_t elapsed_us)
+{
+    double elapsed = elapsed_us / 1e6;
+    double width = (double)stop_mhz - start_mhz;
+    double swept = width * progress / 100;
+    double rate = elapsed > 0 ? swept / elapsed : 0;
+    double eta = rate > 0 ? (width - swept) / rate : -1;
+
+    fprintf(stderr, "PROGRESS SLOT_%d start=%u stop=%u percent=%d found=%d elapsed=%.1f rate=%.2f eta=%.1f\n",
+            session->slot, start_mhz, stop_mhz, progress, num_info, elapsed, rate, eta);
+}
+
+/* The LNB tone selects the high band, if the LNB has one. */
+static bool lnb_tone(const struct scan_job *job)
+{
+    return job->band == BAND_HIGH && lnb.lo_high_khz != lnb.lo_low_khz;
+}
+
+/*
+ * Have the router translate the universal LNB's IF if_mhz to the session's
+ * user band. Both standards shift with an oscillator above the user band
+ * and so invert the spectrum. Returns the IF actually centred on the user
+ * band, the router's step being 4 MHz for EN 50494 and 1 MHz for EN 50607.
+ */
+static uint32_t scr_tune(struct bs_session *session, const struct scan_job *job, uint32_t if_mhz)
+{
+    struct dvb_diseqc_master_cmd cmd = {.msg_len = 5};
+    int ub = lnb.user_band[session->user_band];
+    uint32_t ub_mhz = lnb.user_band_mhz[session->user_band];
+    int pos = DISEQC_KIND(job->diseqc) == DISEQC_COMMITTED ? DISEQC_PORT(job->diseqc) : 0;
+    int bank = !job->vertical << 1 | lnb_tone(job);
+    uint32_t center;
+    int t, fd;
+
+    if (lnb.type == LNB_JESS)
+    {
+        t = if_mhz > 100 ? if_mhz - 100 : 0;
+        center = t + 100;
+        cmd.msg_len = 4;
+        cmd.msg[0] = 0x70;
+        cmd.msg[1] = ub << 3 | (t >> 8 & 0x7);
+        cmd.msg[2] = t & 0xff;
+        cmd.msg[3] = (pos & 0x3f) << 2 | bank;
+    }
+    else
+    {
+        t = (if_mhz + ub_mhz + 2) / 4 - 350;
+        center = (t + 350) * 4 - ub_mhz;
+        cmd.msg[0] = 0xe0;
+        cmd.msg[1] = 0x10;
+        cmd.msg[2] = 0x5a;
+        cmd.msg[3] = ub << 5 | (pos & 0x1) << 4 | bank << 2 | (t >> 8 & 0x3);
+        cmd.msg[4] = t & 0xff;
+    }
+
+    session->if_base_khz = (center + ub_mhz) * 1000;
+
+    if (backend == &mock_backend)
+    {
+        mock_delay(session);
+        return center;
+    }
+
+    fd = lnb_fd(session);
+    if (fd < 0)
+        return center;
+
+    ioctl(fd, FE_SET_TONE, SEC_TONE_OFF);
+    ioctl(fd, FE_SET_VOLTAGE, SEC_VOLTAGE_18);
+    usleep(DISEQC_SETTLE_MS * 1000);
+    ioctl(fd, FE_DISEQC_SEND_MASTER_CMD, &cmd);
+    usleep(DISEQC_SETTLE_MS * 1000);
+    ioctl(fd, FE_SET_VOLTAGE, SEC_VOLTAGE_13);
+    usleep(LNB_SETTLE_MS * 1000);
+
+    return center;
+}
+
+static void blindscan_window(struct bs_session *session, const struct scan_job *job,
+                            uint32_t start_mhz, uint32_t stop_mhz,
+                            uint32_t sr_min_mhz, uint32_t sr_max_mhz,
+                            struct result_list *found)
+{
+    char buf[BUFSIZ];
+    int ret;
+    int status, num_info, progress;
+    int last_status, last_num_info, last_progress;
+    struct bs_status st;
+    int fetched = 0;
+    bool woken = false;
+    bool checkpoint = session->checkpoint && session->user_band < 0;
+    uint64_t start_us, progress_us = 0;
+    uint64_t t;
+
+    sprintf(buf, "1 %u %u %u %u", start_mhz, stop_mhz, sr_min_mhz, sr_max_mhz);
+    ret = bs_ctrl_write(session, buf, strlen(buf));
+    if (ret < 0)
+        return;
+
+    if (checkpoint)
+        checkpoint_begin(session, start_mhz, sr_min_mhz, sr_max_mhz);
+
+    start_us = now_us();
+    last_status = last_num_info = last_progress = -1;
+
+    for (;;)
+    {
+        if (signal_status)
+        {
+            /* Free the tuner first, then collect what was found so far. */
+            sprintf(buf, "0 0 0 0 0");
+            bs_ctrl_write(session, buf, strlen(buf));
+
+            ret = bs_ctrl_read(session, buf, sizeof(buf));
+            if (ret > 0 && bs_parse_status("bs_ctrl", buf, ret, &st) == 0 && st.num_info > last_num_info)
+                last_num_info = st.num_info;
+
+            fetch_results(session, job, &fetched, last_num_info, found, true);
+            if (checkpoint)
+                checkpoint_frontier(session, sweep_frontier(start_mhz, stop_mhz, sr_max_mhz, last_progress), true);
+            return;
+        }
+
+        t = stats_begin();
+        ret = bs_ctrl_read(session, buf, sizeof(buf));
+        stats_end(STAT_CTRL_POLL, t);
+        if (ret < 0 || bs_parse_status("bs_ctrl", buf, ret, &st) < 0)
+            return;
+
+        status = st.status;
+        num_info = st.num_info;
+        progress = st.progress;
+        if (!status)
+            break;
+
+        if (woken && status == last_status && num_info == last_num_info && progress == last_progress)
+        {
+            if (++session->ctrl_spurious >= STATUS_SPURIOUS_MAX)
+                session->ctrl_pollable = false;
+        }
+        else if (woken)
+        {
+            session->ctrl_spurious = 0;
+        }
+
+        last_status = status;
+        last_num_info = num_info;
+        last_progress = progress;
+
+        if (stream)
+            fetch_results(session, job, &fetched, num_info, found, false);
+
+        /* Everything found so far has been fetched only when streaming. */
+        if (checkpoint && stream)
+            checkpoint_frontier(session, sweep_frontier(start_mhz, stop_mhz, sr_max_mhz, progress), false);
+
+        if (progress_ms && now_us() - progress_us >= (uint64_t)progress_ms * 1000)
+        {
+            progress_us = now_us();
+            print_progress(session, start_mhz, stop_mhz, progress, num_info, progress_us - start_us);
+        }
+
+        woken = bs_session_wait(session, status_poll_interval(now_us() - start_us, progress));
+    }
+
+    stats_end(STAT_SCAN, start_us);
+    session->swept_mhz += stop_mhz - start_mhz;
+
+    if (progress_ms)
+        print_progress(session, start_mhz, stop_mhz, 100, num_info, now_us() - start_us);
+
+    /* The tuner is idle already, so a signal doesn't cut the results short. */
+    fetch_results(session, job, &fetched, num_info, found, true);
+
+    if (checkpoint)
+        checkpoint_end(session, stop_mhz);
+}
+
+/*
+ * The highest symbol rate whose carriers fit the narrowest user band with
+ * room for a step of at least SCR_STEP_MIN_MHZ between windows.
+ */
+static uint32_t scr_symbolrate_max(void)
+{
+    uint32_t width = UINT32_MAX;
+
+    for (int i = 0; i < lnb.num_user_bands; i++)
+    {
+        if (lnb.user_band_width_mhz[i] < width)
+            width = lnb.user_band_width_mhz[i];
+    }
+
+    return (width - SCR_STEP_MIN_MHZ - 1) * 100 / 135;
+}
+
+/*
+ * A router only passes the slice of spectrum it translates to the user band
+ * of the session, so sweep start_mhz...stop_mhz in windows and move the slice
+ * before each one. Windows are as wide as the user band and overlap by the
+ * occupied bandwidth of the widest carrier, so every carrier is fully inside
+ * one of them; scr_symbolrate_max() keeps that overlap a step short of the
+ * window. Results are mapped back to the LNB's IF.
+ */
+static void blindscan_sweep(struct bs_session *session, const struct scan_job *job,
+                            uint32_t start_mhz, uint32_t stop_mhz,
+                            uint32_t sr_min_mhz, uint32_t sr_max_mhz,
+                            struct result_list *found)
+{
+    uint32_t ub_mhz, width, half;
+    uint32_t tune_mhz = lnb.type == LNB_JESS ? 1 : 4;
+    uint32_t occupied = sr_max_mhz * 135 / 100 + 1;
+    uint32_t step, center;
+
+    if (session->user_band < 0)
+    {
+        blindscan_window(session, job, start_mhz, stop_mhz, sr_min_mhz, sr_max_mhz, found);
+        return;
+    }
+
+    if (session->checkpoint)
+        checkpoint_begin(session, start_mhz, sr_min_mhz, sr_max_mhz);
+
+    ub_mhz = lnb.user_band_mhz[session->user_band];
+    width = lnb.user_band_width_mhz[session->user_band];
+    half = width / 2;
+
+    /* The router moves the slice in steps of tune_mhz. */
+    step = (width - occupied) / tune_mhz * tune_mhz;
+    for (uint32_t want = start_mhz + half; !signal_status; want = center + step)
+    {
+        center = scr_tune(session, job, want);
+        blindscan_window(session, job, ub_mhz - half, ub_mhz + half, sr_min_mhz, sr_max_mhz, found);
+
+        if (center + half >= stop_mhz)
+            break;
+
+        /* Every carrier centred below the next window has been found. */
+        if (session->checkpoint && !signal_status)
+            checkpoint_frontier(session, center + step - half, true);
+    }
+
+    if (session->checkpoint && !signal_status)
+        checkpoint_end(session, stop_mhz);
+
+    session->if_base_khz = 0;
+}
+
+/* Sweep the parts of start_mhz...stop_mhz not done before a resumed job was interrupted. */
+static void blindscan_range(struct bs_session *session, const struct scan_job *job,
+                            uint32_t start_mhz, uint32_t stop_mhz,
+                            uint32_t sr_min_mhz, uint32_t sr_max_mhz,
+                            struct result_list *found)
+{
+    uint32_t lo = start_mhz, hi = stop_mhz;
+
+    if (session->checkpoint == NULL)
+    {
+        blindscan_sweep(session, job, start_mhz, stop_mhz, sr_min_mhz, sr_max_mhz, found);
+        return;
+    }
+
+    while (!signal_status && checkpoint_next(session->checkpoint, &lo, &hi, sr_min_mhz, sr_max_mhz))
+    {
+        blindscan_sweep(session, job, lo, hi, sr_min_mhz, sr_max_mhz, found);
+        lo = hi;
+        hi = stop_mhz;
+    }
+}
+
+static int result_cmp(const void *a, const void *b)
+{
+    const struct bs_result *ra = a;
+    const struct bs_result *rb = b;
+
+    return (ra->frequency > rb->frequency) - (ra->frequency < rb->frequency);
+}
+
+/*
+ * Blind scan the parts of start_mhz...stop_mhz not occupied by the carriers in
+ * found, skipping gaps too narrow to hold a carrier of sr_min_mhz. Carriers
+ * are assumed to occupy 1.35 times their symbol rate. New carriers are
+ * appended to found.
+ */
+static void blindscan_gaps(struct bs_session *session, const struct scan_job *job,
+                           uint32_t start_mhz, uint32_t stop_mhz,
+                           uint32_t sr_min_mhz, uint32_t sr_max_mhz,
+                           struct result_list *found)
+{
+    uint32_t min_gap = sr_min_mhz * 1350;
+    uint32_t pos = start_mhz * 1000;
+    uint32_t stop = stop_mhz * 1000;
+    int num = found->num;
+
+    qsort(found->r, num, sizeof(*found->r), result_cmp);
+
+    for (int i = 0; i <= num && !signal_status; i++)
+    {
+        uint32_t lo = stop, hi = stop;
+
+        if (i < num)
+        {
+            uint32_t half = (uint32_t)((uint64_t)found->r[i].symbol_rate * 27 / 40000);
+
+            lo = found->r[i].frequency > half ? found->r[i].frequency - half : 0;
+            hi = found->r[i].frequency + half;
+        }
+
+        if (lo > stop)
+            lo = stop;
+
+        if (lo > pos && lo - pos >= min_gap)
+            blindscan_range(session, job, pos / 1000, (lo + 999) / 1000, sr_min_mhz, sr_max_mhz, found);
+
+        if (hi > pos)
+            pos = hi;
+
+        if (pos >= stop)
+            break;
+    }
+}
+
+static int level_cmp(const void *a, const void *b)
+{
+    const int64_t *la = a;
+    const int64_t *lb = b;
+
+    return (*la > *lb) - (*la < *lb);
+}
+
+/*
+ * Sample the power of the range of job every prescan_mhz and return the
+ * sub-ranges with energy in them, widened by a step and by half the occupied
+ * bandwidth of the widest carrier. The noise floor is the 20th percentile of
+ * the samples and a sample is occupied a quarter of the way from there to
+ * the peak. Returns the number of spans, or -1 if the whole range has to be
+ * scanned.
+ */
+static int spectrum_map(struct bs_session *session, const struct scan_job *job, struct span **spans)
+{
+    uint32_t start = job->start_frequency_mhz;
+    uint32_t stop = job->stop_frequency_mhz;
+    uint32_t pad = prescan_mhz + job->symbolrate_max_mhz * 135 / 200 + 1;
+    int64_t *level, *sorted;
+    int64_t floor, peak, threshold;
+    struct span *sp;
+    uint64_t t;
+    int n, num = 0, occupied = 0;
+
+    if (session->backend->power == NULL || session->user_band >= 0 || stop <= start)
+        return -1;
+
+    n = (stop - start) / prescan_mhz + 1;
+    level = malloc(2 * n * sizeof(*level));
+    sp = malloc(n * sizeof(*sp));
+    if (level == NULL || sp == NULL)
+    {
+        free(level);
+        free(sp);
+        return -1;
+    }
+
+    t = stats_begin();
+
+    for (int i = 0; i < n; i++)
+    {
+        if (signal_status || !session->backend->power(session, start + i * prescan_mhz, &level[i]))
+        {
+            free(level);
+            free(sp);
+            return -1;
+        }
+    }
+
+    sorted = level + n;
+    memcpy(sorted, level, n * sizeof(*level));
+    qsort(sorted, n, sizeof(*sorted), level_cmp);
+
+    floor = sorted[n / 5];
+    peak = sorted[n - 1];
+    threshold = floor + (peak - floor) / 4;
+
+    for (int i = 0; i < n; i++)
+        occupied += level[i] > threshold;
+
+    /*
+     * A flat map, e.g. from a driver without a level, proves nothing. Nor
+     * does one of a crowded band, whose floor is the level of a carrier.
+     */
+    if (peak <= floor || occupied > n / 2)
+    {
+        free(level);
+        free(sp);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t f = start + i * prescan_mhz;
+        uint32_t lo = f > start + pad ? f - pad : start;
+        uint32_t hi = f + pad < stop ? f + pad : stop;
+
+        if (level[i] <= threshold)
+            continue;
+
+        if (num && lo <= sp[num - 1].stop_mhz)
+        {
+            sp[num - 1].stop_mhz = hi;
+        }
+        else
+        {
+            sp[num].start_mhz = lo;
+            sp[num].stop_mhz = hi;
+            num++;
+        }
+    }
+
+    stats_end(STAT_PRESCAN, t);
+
+    free(level);
+    *spans = sp;
+
+    return num;
+}
+
+static void blindscan_full(struct bs_session *session, const struct scan_job *job, struct result_list *found)
+{
+    struct result_list pass = {NULL, 0};
+    struct span whole = {job->start_frequency_mhz, job->stop_frequency_mhz};
+    struct span *spans = &whole;
+    int num = 1;
+
+    if (prescan_mhz && (num = spectrum_map(session, job, &spans)) < 0)
+    {
+        spans = &whole;
+        num = 1;
+    }
+
+    if (symbolrate_split_mhz <= job->symbolrate_min_mhz || symbolrate_split_mhz >= job->symbolrate_max_mhz)
+    {
+        for (int i = 0; i < num && !signal_status; i++)
+            blindscan_range(session, job, spans[i].start_mhz, spans[i].stop_mhz,
+                            job->symbolrate_min_mhz, job->symbolrate_max_mhz, found);
+    }
+    else
+    {
+        if (found == NULL)
+            found = &pass;
+
+        for (int i = 0; i < num && !signal_status; i++)
+            blindscan_range(session, job, spans[i].start_mhz, spans[i].stop_mhz,
+                            symbolrate_split_mhz, job->symbolrate_max_mhz, found);
+
+        for (int i = 0; i < num && !signal_status; i++)
+            blindscan_gaps(session, job, spans[i].start_mhz, spans[i].stop_mhz,
+                           job->symbolrate_min_mhz, symbolrate_split_mhz, found);
+    }
+
+    if (spans != &whole)
+        free(spans);
+    free(pass.r);
+}
+
+static bool dvb_tune(int fd, const struct bs_result *r, int timeout_ms)
+{
+    struct dtv_property p[] = {
+        {.cmd = DTV_CLEAR},
+        {.cmd = DTV_DELIVERY_SYSTEM, .u.data = r->delivery_system},
+        {.cmd = DTV_FREQUENCY, .u.data = r->frequency},
+        {.cmd = DTV_SYMBOL_RATE, .u.data = r->symbol_rate},
+        {.cmd = DTV_INNER_FEC, .u.data = r->fec_inner},
+        {.cmd = DTV_MODULATION, .u.data = r->modulation},
+        {.cmd = DTV_INVERSION, .u.data = r->inversion},
+        {.cmd = DTV_ROLLOFF, .u.data = r->rolloff},
+        {.cmd = DTV_PILOT, .u.data = r->pilot},
+        {.cmd = DTV_STREAM_ID, .u.data = NO_STREAM_ID_FILTER},
+        {.cmd = DTV_TUNE},
+    };
+    struct dtv_properties props = {
+        .num = sizeof(p) / sizeof(p[0]),
+        .props = p,
+    };
+    fe_status_t status;
+
+    if (r->is_id >= 0)
+        p[9].u.data = (r->is_id & 0xff) | ((r->pls_code & 0x3ffff) << 8) | ((r->pls_mode & 0x3) << 26);
+
+    if (ioctl(fd, FE_SET_PROPERTY, &props) < 0)
+        return false;
+
+    for (int waited = 0; waited < timeout_ms && !signal_status; waited += VERIFY_POLL_MS)
+    {
+        if (ioctl(fd, FE_READ_STATUS, &status) == 0 && (status & FE_HAS_LOCK))
+            return true;
+
+        usleep(VERIFY_POLL_MS * 1000);
+    }
+
+    return false;
+}
+
+static void diseqc_send(int fd, const struct scan_job *job)
+{
+    struct dvb_diseqc_master_cmd cmd = {
+        .msg = {0xe0, 0x10, 0x38, 0xf0},
+        .msg_len = 4,
+    };
+    int port = DISEQC_PORT(job->diseqc);
+
+    switch (DISEQC_KIND(job->diseqc))
+    {
+    case DISEQC_COMMITTED:
+        cmd.msg[3] = 0xf0 | port << 2 | !job->vertical << 1 | lnb_tone(job);
+        break;
+    case DISEQC_UNCOMMITTED:
+        cmd.msg[2] = 0x39;
+        cmd.msg[3] = 0xf0 | port;
+        break;
+    case DISEQC_POSITION:
+        cmd.msg[1] = 0x31;
+        cmd.msg[2] = 0x6b;
+        cmd.msg[3] = port;
+        break;
+    default:
+        return;
+    }
+
+    ioctl(fd, FE_SET_TONE, SEC_TONE_OFF);
+    ioctl(fd, FE_SET_VOLTAGE, job->vertical ? SEC_VOLTAGE_13 : SEC_VOLTAGE_18);
+    usleep(DISEQC_SETTLE_MS * 1000);
+    ioctl(fd, FE_DISEQC_SEND_MASTER_CMD, &cmd);
+    usleep(DISEQC_SETTLE_MS * 1000);
+    ioctl(fd, FE_SET_TONE, lnb_tone(job) ? SEC_TONE_ON : SEC_TONE_OFF);
+}
+
+/*
+ * Route the frontend to the switch position, polarity and band of job,
+ * touching only what differs from the previous job of the session. The
+ * committed switch command also carries polarity and band, so it is
+ * repeated whenever one of them changes. A positioner only needs time to
+ * move when its position does. If the frontend cannot be opened, another
+ * process is assumed to control the LNB.
+ */
+static void lnb_setup(struct bs_session *session, const struct scan_job *job)
+{
+    bool moved = !session->lnb_valid || session->lnb_diseqc != job->diseqc;
+    bool voltage = !session->lnb_valid || session->lnb_vertical != job->vertical;
+    bool tone = !session->lnb_valid || (session->lnb_band == BAND_HIGH) != (job->band == BAND_HIGH);
+    int fd;
+
+    session->lnb_valid = true;
+    session->lnb_diseqc = job->diseqc;
+    session->lnb_vertical = job->vertical;
+    session->lnb_band = job->band;
+
+    if (!moved && !voltage && !tone)
+        return;
+
+    if (moved && job->diseqc != DISEQC_NONE)
+    {
+        pthread_mutex_lock(&stats_lock);
+        stats_switch_changes++;
+        pthread_mutex_unlock(&stats_lock);
+    }
+
+    /* Behind a router the bank and position go with each channel change. */
+    if (session->user_band >= 0 || (external_lnb && job->diseqc == DISEQC_NONE))
+        return;
+
+    if (backend == &mock_backend)
+    {
+        mock_delay(session);
+        return;
+    }
+
+    fd = lnb_fd(session);
+    if (fd < 0)
+        return;
+
+    if (job->diseqc != DISEQC_NONE && (moved || DISEQC_KIND(job->diseqc) == DISEQC_COMMITTED))
+    {
+        diseqc_send(fd, job);
+        if (moved && DISEQC_KIND(job->diseqc) == DISEQC_POSITION)
+            usleep(DISEQC_MOVE_MS * 1000);
+        return;
+    }
+
+    if (voltage)
+        ioctl(fd, FE_SET_VOLTAGE, job->vertical ? SEC_VOLTAGE_13 : SEC_VOLTAGE_18);
+    if (tone)
+        ioctl(fd, FE_SET_TONE, lnb_tone(job) ? SEC_TONE_ON : SEC_TONE_OFF);
+
+    usleep(LNB_SETTLE_MS * 1000);
+}
+
+static void dvb_signal(int fd, struct bs_verify *v)
+{
+    struct dtv_property p[] = {
+        {.cmd = DTV_STAT_CNR},
+        {.cmd = DTV_STAT_POST_ERROR_BIT_COUNT},
+        {.cmd = DTV_STAT_POST_TOTAL_BIT_COUNT},
+    };
+    struct dtv_properties props = {
+        .num = sizeof(p) / sizeof(p[0]),
+        .props = p,
+    };
+
+    if (ioctl(fd, FE_GET_PROPERTY, &props) < 0)
+        return;
+
+    if (p[0].u.st.len && p[0].u.st.stat[0].scale == FE_SCALE_DECIBEL)
+    {
+        v->has_cnr = true;
+        v->cnr = p[0].u.st.stat[0].svalue;
+    }
+
+    if (p[1].u.st.len && p[1].u.st.stat[0].scale == FE_SCALE_COUNTER &&
+        p[2].u.st.len && p[2].u.st.stat[0].scale == FE_SCALE_COUNTER && p[2].u.st.stat[0].uvalue)
+    {
+        v->has_ber = true;
+        v->ber = (double)p[1].u.st.stat[0].uvalue / p[2].u.st.stat[0].uvalue;
+    }
+}
+
+/* The simulated tuner locks everything, with a CNR falling with symbol rate. */
+static void mock_tune(const struct bs_result *r, struct bs_verify *v)
+{
+    mock_delay(NULL);
+
+    v->verified = true;
+    v->locked = true;
+    v->has_cnr = true;
+    v->cnr = 16000 - (int64_t)r->symbol_rate / 10000;
+    v->has_ber = true;
+    v->ber = 0;
+}
+
+static void *verify_main(void *arg)
+{
+    struct verify_item *item;
+    struct bs_verify v;
+    struct bs_session tuner = {
+        .fe_id = *(int *)arg,
+        .dvb_fd = -1,
+        .user_band = -1,
+    };
+    int fd = verify_fd;
+    uint64_t t;
+
+    tuner.dvb_fd = fd;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&verify_lock);
+        while (!num_verify && !verify_finished)
+            pthread_cond_wait(&verify_cond, &verify_lock);
+
+        item = NULL;
+        if (num_verify)
+        {
+            item = verify_queue[0];
+            memmove(verify_queue, verify_queue + 1, --num_verify * sizeof(*verify_queue));
+        }
+        pthread_mutex_unlock(&verify_lock);
+
+        if (item == NULL)
+            break;
+
+        /* Results still queued when the scan is stopped are not tuned. */
+        memset(&v, 0, sizeof(v));
+        if (!signal_status)
+            lnb_setup(&tuner, &item->job);
+
+        if (signal_status)
+        {
+            v.verified = false;
+        }
+        else if (backend == &mock_backend)
+        {
+            mock_tune(&item->r, &v);
+        }
+        else
+        {
+            v.verified = true;
+            if (dvb_tune(fd, &item->r, VERIFY_TIMEOUT_MS))
+            {
+                v.locked = true;
+                usleep(VERIFY_STATS_MS * 1000);
+                dvb_signal(fd, &v);
+            }
+        }
+
+        t = stats_begin();
+        print_result(&item->r, item->slot, &item->job, &v);
+        stats_end(STAT_FORMAT, t);
+        stats_result();
+        free(item);
+    }
+
+    return NULL;
+}
+
+/*
+ * Verify results on the frontend fe_id while scanning continues on the
+ * others. Results are queued by output_result() and printed in the order
+ * they were found, annotated with lock state and signal quality.
+ */
+static int verify_start(int *fe_id)
+{
+    /* The verifying tuner is guarded against other instances like a scanning one. */
+    if (backend != &mock_backend)
+    {
+        verify_lock_fd = frontend_lock(*fe_id);
+        if (verify_lock_fd < 0)
+            return -1;
+
+        verify_fd = dvb_open(*fe_id);
+        if (verify_fd < 0)
+        {
+            frontend_unlock(verify_lock_fd);
+            verify_lock_fd = -1;
+            return -1;
+        }
+    }
+
+    if (pthread_create(&verify_thread, NULL, verify_main, fe_id))
+    {
+        if (verify_fd >= 0)
+            close(verify_fd);
+        if (verify_lock_fd >= 0)
+            frontend_unlock(verify_lock_fd);
+        verify_fd = verify_lock_fd = -1;
+        return -1;
+    }
+
+    verify_running = true;
+
+    return 0;
+}
+
+static void verify_finish(void)
+{
+    if (!verify_running)
+        return;
+
+    pthread_mutex_lock(&verify_lock);
+    verify_finished = true;
+    pthread_cond_signal(&verify_cond);
+    pthread_mutex_unlock(&verify_lock);
+
+    pthread_join(verify_thread, NULL);
+    verify_running = false;
+    free(verify_queue);
+
+    if (verify_fd >= 0)
+        close(verify_fd);
+    if (verify_lock_fd >= 0)
+        frontend_unlock(verify_lock_fd);
+    verify_fd = verify_lock_fd = -1;
+}
+
+static void cache_filename(char *filename, const struct scan_job *job)
+{
+    char lnb[32];
+
+    if (job->slot == -1)
+        strcpy(lnb, "any");
+    else
+        sprintf(lnb, "%d", job->slot);
+
+    if (job->diseqc != DISEQC_NONE)
+        sprintf(lnb + strlen(lnb), "-%s%d", diseqc_names[DISEQC_KIND(job->diseqc)].s, DISEQC_PORT(job->diseqc));
+
+    snprintf(filename, PATH_MAX, "%s/blindscan-%s-%c-%s-%u-%u.cache",
+             cache_dir, lnb, job->vertical ? 'V' : 'H', band_names[job->band].s,
+             job->start_frequency_mhz, job->stop_frequency_mhz);
+}
+
+static int cache_load(const char *filename, struct result_list *cached)
+{
+    FILE *fp;
+    char *line = NULL;
+    const char *p;
+    size_t len = 0;
+    ssize_t n;
+    struct bs_result r;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+        return -1;
+
+    while ((n = getline(&line, &len, fp)) != -1)
+    {
+        p = line;
+        if (bs_parse_result(filename, &p, line + n, &r) == 0)
+            result_list_add(cached, &r);
+    }
+
+    fclose(fp);
+    free(line);
+
+    return 0;
+}
+
+static int cache_save(const char *filename, const struct result_list *found)
+{
+    char tmpname[PATH_MAX + 4];
+    FILE *fp;
+
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+
+    fp = fopen(tmpname, "w");
+    if (fp == NULL)
+        return -1;
+
+    for (int i = 0; i < found->num; i++)
+        result_save(fp, i, &found->r[i]);
+
+    return file_commit(fp, tmpname, filename);
+}
+
+/*
+ * Quick tune every cached transponder through the DVB frontend. A single one
+ * failing to lock means the band changed enough to warrant a full scan.
+ */
+static bool cache_verify(struct bs_session *session, const struct result_list *cached)
+{
+    bool ok = true;
+    int fd;
+
+    /* The session holds the frontend's only writable descriptor. */
+    fd = lnb_fd(session);
+    if (fd < 0)
+        return false;
+
+    for (int i = 0; i < cached->num && ok && !signal_status; i++)
+        ok = dvb_tune(fd, &cached->r[i], VERIFY_TIMEOUT_MS);
+
+    return ok && !signal_status;
+}
+
+static void blindscan_session(struct bs_session *session, const struct scan_job *job)
+{
+    struct result_list found = {NULL, 0};
+    struct result_list cached = {NULL, 0};
+    struct checkpoint *cp = checkpoint_get(job);
+    bool resumed = cp && (cp->num_done || cp->found.num);
+    char filename[PATH_MAX];
+
+    if (cache_dir == NULL && cp == NULL)
+    {
+        blindscan_full(session, job, NULL);
+        return;
+    }
+
+    /* A resumed job starts out with what it found before. */
+    if (cp)
+    {
+        for (int i = 0; i < cp->found.num; i++)
+            emit_result(session, job, &cp->found.r[i], &found);
+        session->checkpoint = cp;
+    }
+
+    if (cache_dir)
+        cache_filename(filename, job);
+
+    if (cp && cp->complete)
+    {
+        /* Nothing left to scan. */
+    }
+    else if (resumed && !cp->gaps)
+    {
+        blindscan_full(session, job, &found);
+    }
+    else if (resumed || (cache_dir && incremental && cache_load(filename, &cached) == 0 && cached.num &&
+                         cache_verify(session, &cached)))
+    {
+        if (cp && !resumed)
+            checkpoint_finish(cp, true, false);
+
+        for (int i = 0; i < cached.num; i++)
+            emit_result(session, job, &cached.r[i], &found);
+
+        blindscan_gaps(session, job, job->start_frequency_mhz, job->stop_frequency_mhz,
+                       job->symbolrate_min_mhz, job->symbolrate_max_mhz, &found);
+    }
+    else
+    {
+        blindscan_full(session, job, &found);
+    }
+
+    if (cache_dir && !signal_status)
+        cache_save(filename, &found);
+
+    if (cp && !signal_status)
+        checkpoint_finish(cp, cp->gaps, true);
+
+    session->checkpoint = NULL;
+
+    free(cached.r);
+    free(found.r);
+}
+
+static void blindscan_worker(struct bs_session *session, bool wait)
+{
+    struct scan_job *job;
+
+    while ((job = jobs_next(session->slot, session->lnb_valid ? session->lnb_diseqc : DISEQC_NONE, wait)))
+    {
+        /* A job taken is always marked done, someone may be waiting for it. */
+        if (!signal_status)
+        {
+            lnb_setup(session, job);
+            blindscan_session(session, job);
+        }
+
+        /* Daemon sessions live on, so don't keep other users off the tuner. */
+        if (daemon_path)
+            lnb_release(session);
+        jobs_done(job);
+
+        if (signal_status)
+            break;
+    }
+}
+
+static int blindscan(int fe_id, int slot_id)
+{
+    struct bs_session session;
+
+    if (bs_session_open(&session, fe_id, slot_id) < 0)
+        return -1;
+
+    blindscan_worker(&session, false);
+
+    bs_session_close(&session);
+
+    return 0;
+}
+
+static struct nim_slot *nim_add(struct nim_topology *topo, int slot_id)
+{
+    struct nim_slot *n;
+
+    n = realloc(topo->slots, (topo->num + 1) * sizeof(*topo->slots));
+    if (n == NULL)
+        return NULL;
+
+    topo->slots = n;
+    n = &topo->slots[topo->num++];
+    n->slot = slot_id;
+    n->fe_id = -1;
+    n->i2c = -1;
+    n->type[0] = '\0';
+    n->blindscan = false;
+
+    return n;
+}
+
+static void nim_free(struct nim_topology *topo)
+{
+    free(topo->slots);
+    topo->slots = NULL;
+    topo->num = 0;
+}
+
+static int nim_sockets(struct nim_topology *topo)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t n;
+    struct nim_slot *nim = NULL;
+    char path[PATH_MAX];
+
+    topo->slots = NULL;
+    topo->num = 0;
+
+    fp = fopen("/proc/bus/nim_sockets", "r");
+    if (fp == NULL)
+        return -1;
+
+    while ((n = getline(&line, &len, fp)) != -1)
+    {
+        int val;
+
+        if (strstr(line, "NIM Socket") == line)
+        {
+            nim = NULL;
+            if (sscanf(line, "NIM Socket %d", &val) == 1 && val >= 0)
+                nim = nim_add(topo, val);
+        }
+        else if (nim == NULL)
+        {
+            continue;
+        }
+        else if (strstr(line, "\tFrontend_Device") == line)
+        {
+            if (sscanf(line, "\tFrontend_Device: %d", &val) == 1)
+                nim->fe_id = val;
+        }
+        else if (strstr(line, "\tI2C_Device") == line)
+        {
+            if (sscanf(line, "\tI2C_Device: %d", &val) == 1)
+                nim->i2c = val;
+        }
+        else if (strstr(line, "\tType") == line)
+        {
+            sscanf(line, "\tType: %31s", nim->type);
+        }
+    }
+
+    fclose(fp);
+    if (line)
+        free(line);
+
+    for (int i = 0; i < topo->num; i++)
+    {
+        nim = &topo->slots[i];
+        if (nim->fe_id == -1)
+            continue;
+
+        sprintf(path, "/proc/stb/frontend/%d/bs_ctrl", nim->fe_id);
+        nim->blindscan = !access(path, R_OK);
+    }
+
+    return 0;
+}
+
+static int nim_mock(struct nim_topology *topo)
+{
+    struct nim_slot *nim;
+    int num = bench_tuners > MOCK_SLOTS ? bench_tuners : MOCK_SLOTS;
+
+    topo->slots = NULL;
+    topo->num = 0;
+
+    for (int i = 0; i < num; i++)
+    {
+        nim = nim_add(topo, i);
+        if (nim == NULL)
+            return -1;
+
+        nim->fe_id = i;
+        nim->i2c = mock_i2c_buses ? i % mock_i2c_buses : i;
+        strcpy(nim->type, "MOCK");
+        nim->blindscan = true;
+    }
+
+    return 0;
+}
+
+static int nim_load(struct nim_topology *topo)
+{
+    if (backend == &mock_backend)
+        return nim_mock(topo);
+
+    return nim_sockets(topo);
+}
+
+static const struct nim_slot *nim_find(const struct nim_topology *topo, int slot_id)
+{
+    for (int i = 0; i < topo->num; i++)
+    {
+        if (topo->slots[i].slot == slot_id && topo->slots[i].fe_id != -1)
+            return &topo->slots[i];
+    }
+
+    return NULL;
+}
+
+static void *scan_thread_main(void *arg)
+{
+    struct scan_thread *t = arg;
+
+    blindscan(t->fe_id, t->slot);
+
+    return NULL;
+}
+
+static void blindscan_parallel(const struct nim_topology *topo)
+{
+    struct scan_thread *threads;
+    int num_threads = 0;
+
+    threads = calloc(topo->num, sizeof(*threads));
+    if (threads == NULL)
+        return;
+
+    if (all_slots)
+    {
+        for (int i = 0; i < topo->num; i++)
+        {
+            if (!topo->slots[i].blindscan || topo->slots[i].slot == verify_slot)
+                continue;
+
+            threads[num_threads].slot = topo->slots[i].slot;
+            threads[num_threads].fe_id = topo->slots[i].fe_id;
+            num_threads++;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < num_slots && num_threads < topo->num; i++)
+        {
+            const struct nim_slot *nim = nim_find(topo, slots[i]);
+
+            if (nim == NULL || nim->slot == verify_slot)
+                continue;
+
+            threads[num_threads].slot = nim->slot;
+            threads[num_threads].fe_id = nim->fe_id;
+            num_threads++;
+        }
+    }
+
+    /* Tuners behind one router share its feed, one per user band and each with a share of the range. */
+    if (lnb.num_user_bands && num_threads > lnb.num_user_bands)
+        num_threads = lnb.num_user_bands;
+
+    if (plan == NULL && campaign == NULL && (split_mhz || lnb.num_user_bands))
+    {
+        jobs_add(-1, vertical, default_band());
+    }
+    else if (plan == NULL && campaign == NULL)
+    {
+        for (int i = 0; i < num_threads; i++)
+            jobs_add(threads[i].slot, vertical, default_band());
+    }
+
+    jobs_split(jobs_split_mhz(num_threads));
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        if (pthread_create(&threads[i].thread, NULL, scan_thread_main, &threads[i]))
+            threads[i].fe_id = -1;
+    }
+
+    for (int i = 0; i < num_threads; i++)
+    {
+        if (threads[i].fe_id != -1)
+            pthread_join(threads[i].thread, NULL);
+    }
+
+    free(threads);
+}
+
+static void *bench_thread_main(void *arg)
+{
+    struct scan_thread *t = arg;
+    uint64_t start_us = now_us();
+
+    if (bs_session_open(&t->session, t->fe_id, t->slot) == 0)
+    {
+        blindscan_worker(&t->session, false);
+        bs_session_close(&t->session);
+    }
+
+    t->elapsed_us = now_us() - start_us;
+
+    return NULL;
+}
+
+/*
+ * Order the tuners --bench may use so that each round adds tuners on the
+ * I2C bus with the fewest of them so far.
+ */
+static int bench_order(const struct nim_topology *topo, const struct nim_slot **order)
+{
+    const struct nim_slot *cand[NIM_SLOTS_MAX];
+    int bus[NIM_SLOTS_MAX];
+    int num = 0, n = 0;
+
+    for (int i = 0; i < topo->num && num < NIM_SLOTS_MAX; i++)
+    {
+        const struct nim_slot *nim = &topo->slots[i];
+        bool listed = !num_slots;
+
+        for (int j = 0; j < num_slots; j++)
+            listed |= slots[j] == nim->slot;
+
+        if (nim->blindscan && nim->fe_id != -1 && listed)
+            cand[num++] = nim;
+    }
+
+    while (n < num)
+    {
+        int num_bus = 0;
+
+        for (int i = 0; i < num; i++)
+        {
+            bool busy = false;
+
+            if (cand[i] == NULL)
+                continue;
+
+            for (int j = 0; j < num_bus; j++)
+                busy |= bus[j] == cand[i]->i2c;
+
+            if (busy)
+                continue;
+
+            bus[num_bus++] = cand[i]->i2c;
+            order[n++] = cand[i];
+            cand[i] = NULL;
+        }
+    }
+
+    return num;
+}
+
+/*
+ * Run one --bench round on the first tuners of order and compare it to the
+ * round with a single tuner. Returns the aggregate MHz/s, and the mean driver
+ * access time in us through *io_mean_us.
+ */
+static double bench_round(const struct nim_slot **order, int tuners, double base_rate, double base_io_us,
+                          double *io_mean_us)
+{
+    struct scan_thread *threads;
+    uint64_t start_us, elapsed_us;
+    uint64_t swept = 0, transponders = 0, io_us = 0, io_calls = 0;
+    double rate;
+
+    *io_mean_us = 0;
+
+    threads = calloc(tuners, sizeof(*threads));
+    if (threads == NULL)
+        return 0;
+
+    jobs_free();
+
+    /* With --split the tuners share one range, otherwise each scans it whole. */
+    if (split_mhz || lnb.num_user_bands)
+        jobs_add(-1, vertical, default_band());
+
+    for (int i = 0; i < tuners; i++)
+    {
+        threads[i].slot = order[i]->slot;
+        threads[i].fe_id = order[i]->fe_id;
+        threads[i].i2c = order[i]->i2c;
+        if (!split_mhz && !lnb.num_user_bands)
+            jobs_add(threads[i].slot, vertical, default_band());
+    }
+
+    jobs_split(jobs_split_mhz(tuners));
+
+    start_us = now_us();
+
+    for (int i = 0; i < tuners; i++)
+    {
+        if (pthread_create(&threads[i].thread, NULL, bench_thread_main, &threads[i]))
+            threads[i].fe_id = -1;
+    }
 
-        j += sprintf(buf + j, " %u", frequency);
+    for (int i = 0; i < tuners; i++)
+    {
+        if (threads[i].fe_id != -1)
+            pthread_join(threads[i].thread, NULL);
+    }
+
+    elapsed_us = now_us() - start_us;
+
+    for (int i = 0; i < tuners; i++)
+    {
+        const struct scan_thread *t = &threads[i];
+        const struct bs_session *s = &t->session;
+        double elapsed = t->elapsed_us / 1e6;
+
+        if (t->fe_id == -1)
+            continue;
+
+        fprintf(stderr, "BENCH tuners=%d slot=%d i2c=%d elapsed=%.3fs mhz=%" PRIu64 " mhz_per_s=%.1f "
+                        "transponders=%" PRIu64 " transponders_per_s=%.1f io_calls=%" PRIu64 " io_mean=%.0fus io_share=%.2f\n",
+                tuners, t->slot, t->i2c, elapsed, s->swept_mhz, elapsed > 0 ? s->swept_mhz / elapsed : 0.0,
+                s->transponders, elapsed > 0 ? s->transponders / elapsed : 0.0, s->io_calls,
+                s->io_calls ? (double)s->io_us / s->io_calls : 0.0,
+                t->elapsed_us ? (double)s->io_us / t->elapsed_us : 0.0);
 
-        symbol_rate = ((symbol_rate + 500) / 1000) * 1000;
+        swept += s->swept_mhz;
+        transponders += s->transponders;
+        io_us += s->io_us;
+        io_calls += s->io_calls;
+    }
+
+    /* Accesses slowing down on one bus more than the others point at the bus. */
+    for (int i = 0; i < tuners; i++)
+    {
+        uint64_t bus_us = 0, bus_calls = 0;
+        int bus_tuners = 0;
+        bool seen = false;
+        double mean;
 
-        j += sprintf(buf + j, " %u", symbol_rate);
+        for (int j = 0; j < i; j++)
+            seen |= threads[j].i2c == threads[i].i2c;
 
-        j += sprintf(buf + j, " %s", delivery_system == SYS_DVBS ? "DVB-S" : "DVB-S2");
+        if (seen)
+            continue;
 
-        switch (inversion)
+        for (int j = i; j < tuners; j++)
         {
-        case INVERSION_OFF:
-            s = "INVERSION_OFF";
-            break;
-        case INVERSION_ON:
-            s = "INVERSION_ON";
-            break;
-        default:
-            s = "INVERSION_AUTO";
-            break;
+            if (threads[j].i2c != threads[i].i2c || threads[j].fe_id == -1)
+                continue;
+
+            bus_tuners++;
+            bus_us += threads[j].session.io_us;
+            bus_calls += threads[j].session.io_calls;
         }
 
-        j += sprintf(buf + j, " %s", s);
+        mean = bus_calls ? (double)bus_us / bus_calls : 0.0;
+        fprintf(stderr, "BENCH tuners=%d i2c=%d bus_tuners=%d io_mean=%.0fus io_slowdown=%.2f\n",
+                tuners, threads[i].i2c, bus_tuners, mean, base_io_us > 0 ? mean / base_io_us : 1.0);
+    }
+
+    rate = elapsed_us ? swept * 1e6 / elapsed_us : 0.0;
+    *io_mean_us = io_calls ? (double)io_us / io_calls : 0.0;
+    if (base_rate <= 0)
+        base_rate = rate;
+
+    fprintf(stderr, "BENCH tuners=%d total elapsed=%.3fs mhz_per_s=%.1f transponders_per_s=%.1f "
+                    "speedup=%.2f efficiency=%.2f io_mean=%.0fus io_slowdown=%.2f\n",
+            tuners, elapsed_us / 1e6, rate, elapsed_us ? transponders * 1e6 / elapsed_us : 0.0,
+            base_rate > 0 ? rate / base_rate : 0.0, base_rate > 0 ? rate / base_rate / tuners : 0.0,
+            *io_mean_us, base_io_us > 0 ? *io_mean_us / base_io_us : 1.0);
+
+    free(threads);
+
+    return rate;
+}
+
+/*
+ * Scan on 1, 2, 4... tuners at once, up to bench_tuners, and report how the
+ * aggregate throughput scales. The driver access time of a lone tuner is the
+ * baseline that contention for procfs and the I2C buses is measured against.
+ */
+static void blindscan_bench(const struct nim_topology *topo)
+{
+    const struct nim_slot *order[NIM_SLOTS_MAX];
+    double base_rate = 0, base_io_us = 0, best_rate = 0;
+    double rate[NIM_SLOTS_MAX + 1] = {0};
+    int num, max;
+
+    num = bench_order(topo, order);
+    max = bench_tuners < num ? bench_tuners : num;
+    if (lnb.num_user_bands && max > lnb.num_user_bands)
+        max = lnb.num_user_bands;
+
+    for (int tuners = 1; tuners <= max && !signal_status; tuners = tuners < max && tuners * 2 > max ? max : tuners * 2)
+    {
+        double io_mean_us;
 
-        switch (pilot)
+        rate[tuners] = bench_round(order, tuners, base_rate, base_io_us, &io_mean_us);
+        if (tuners == 1)
         {
-        case PILOT_ON:
-            s = "PILOT_ON";
-            break;
-        case PILOT_OFF:
-            s = "PILOT_OFF";
-            break;
-        default:
-            s = "PILOT_AUTO";
-            break;
+            base_rate = rate[1];
+            base_io_us = io_mean_us;
         }
 
-        j += sprintf(buf + j, " %s", s);
+        if (rate[tuners] > best_rate)
+            best_rate = rate[tuners];
+    }
 
-        switch (fec_inner)
+    /* The fewest tuners within 5% of the best throughput. */
+    for (int tuners = 1; tuners <= max; tuners++)
+    {
+        if (best_rate > 0 && rate[tuners] >= best_rate * 0.95)
         {
-        case FEC_1_2:
-            s = "FEC_1_2";
-            break;
-        case FEC_2_3:
-            s = "FEC_2_3";
-            break;
-        case FEC_3_4:
-            s = "FEC_3_4";
-            break;
-        case FEC_4_5:
-            s = "FEC_4_5";
-            break;
-        case FEC_5_6:
-            s = "FEC_5_6";
-            break;
-        case FEC_6_7:
-            s = "FEC_6_7";
-            break;
-        case FEC_7_8:
-            s = "FEC_7_8";
-            break;
-        case FEC_8_9:
-            s = "FEC_8_9";
-            break;
-        case FEC_3_5:
-            s = "FEC_3_5";
-            break;
-        case FEC_9_10:
-            s = "FEC_9_10";
-            break;
-        case FEC_2_5:
-            s = "FEC_2_5";
-            break;
-        default:
-            s = "FEC_AUTO";
+            fprintf(stderr, "BENCH best tuners=%d mhz_per_s=%.1f\n", tuners, rate[tuners]);
             break;
         }
+    }
+}
 
-        j += sprintf(buf + j, " %s", s);
+static struct scan_thread **daemon_threads;
+static int num_daemon_threads;
+static pthread_mutex_t daemon_lock = PTHREAD_MUTEX_INITIALIZER;
 
-        switch (modulation)
+static bool daemon_slot_ready(int slot_id)
+{
+    bool ready = false;
+
+    pthread_mutex_lock(&daemon_lock);
+
+    for (int i = 0; i < num_daemon_threads && !ready; i++)
+        ready = daemon_threads[i]->slot == slot_id && daemon_threads[i]->fe_id != -1;
+
+    pthread_mutex_unlock(&daemon_lock);
+
+    return ready;
+}
+
+/*
+ * Parse a job request of the form
+ *   scan [start=<MHz>] [stop=<MHz>] [min=<MS/s>] [max=<MS/s>]
+ *        [pol=H|V] [band=low|high|cband] [slot=<slot>]
+ *        [diseqc=committed|uncommitted|position:<n>]
+ * with the command line options as defaults.
+ */
+static bool daemon_parse(char *line, struct scan_job *job)
+{
+    char *saveptr, *tok, *val;
+    int num;
+
+    memset(job, 0, sizeof(*job));
+    job->slot = slot;
+    job->vertical = vertical;
+    job->band = default_band();
+    job->start_frequency_mhz = start_frequency_mhz;
+    job->stop_frequency_mhz = stop_frequency_mhz;
+    job->symbolrate_min_mhz = symbolrate_min_mhz;
+    job->symbolrate_max_mhz = symbolrate_max_mhz;
+
+    tok = strtok_r(line, " \t\r\n", &saveptr);
+    if (tok == NULL || strcmp(tok, "scan"))
+        return false;
+
+    while ((tok = strtok_r(NULL, " \t\r\n", &saveptr)))
+    {
+        val = strchr(tok, '=');
+        if (val == NULL)
+            return false;
+
+        *val++ = '\0';
+
+        if (!strcmp(tok, "pol"))
         {
-        case PSK_8:
-            s = "8PSK";
-            break;
-        case APSK_16:
-            s = "16APSK";
-            break;
-        case APSK_32:
-            s = "32APSK";
-            break;
-        default:
-            s = "QPSK";
-            break;
+            if (!strcmp(val, "H"))
+                job->vertical = false;
+            else if (!strcmp(val, "V"))
+                job->vertical = true;
+            else
+                return false;
+            continue;
         }
 
-        j += sprintf(buf + j, " %s", s);
+        if (!strcmp(tok, "band"))
+        {
+            for (num = 0; num < (int)(sizeof(band_names) / sizeof(band_names[0])); num++)
+            {
+                if (!strcmp(val, band_names[num].s))
+                    break;
+            }
+
+            if (num == (int)(sizeof(band_names) / sizeof(band_names[0])))
+                return false;
+
+            job->band = num;
+            continue;
+        }
 
-        switch (rolloff)
+        if (!strcmp(tok, "diseqc"))
         {
-        case ROLLOFF_20:
-            s = "ROLLOFF_20";
-            break;
-        case ROLLOFF_25:
-            s = "ROLLOFF_25";
-            break;
-        default:
-            s = "ROLLOFF_35";
-            break;
+            if (!get_diseqc_arg(&job->diseqc, val))
+                return false;
+            continue;
         }
 
-        j += sprintf(buf + j, " %s", s);
+        if (!get_int_arg(&num, val) || num < 0)
+            return false;
+
+        if (!strcmp(tok, "start"))
+            job->start_frequency_mhz = num;
+        else if (!strcmp(tok, "stop"))
+            job->stop_frequency_mhz = num;
+        else if (!strcmp(tok, "min"))
+            job->symbolrate_min_mhz = num;
+        else if (!strcmp(tok, "max"))
+            job->symbolrate_max_mhz = num;
+        else if (!strcmp(tok, "slot"))
+            job->slot = num;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+static void daemon_end(FILE *out)
+{
+    uint16_t length = 0;
+
+    if (format == FORMAT_BINARY)
+        fwrite(&length, sizeof(length), 1, out);
+    else
+        fprintf(out, "END\n");
 
-        j += sprintf(buf + j, " %d", pls_mode);
+    fflush(out);
+}
+
+static void *daemon_client_main(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    struct scan_job tmpl, *job;
+    char *line = NULL;
+    size_t len = 0;
+    FILE *in, *out;
+    int out_fd;
 
-        j += sprintf(buf + j, " %d", is_id);
+    out_fd = dup(fd);
+    in = fdopen(fd, "r");
+    out = out_fd < 0 ? NULL : fdopen(out_fd, "w");
+    if (in == NULL || out == NULL)
+    {
+        if (in)
+            fclose(in);
+        else
+            close(fd);
+        if (out_fd >= 0 && out == NULL)
+            close(out_fd);
+        return NULL;
+    }
 
-        j += sprintf(buf + j, " %d", pls_code);
+    while (getline(&line, &len, in) != -1 && !signal_status)
+    {
+        if (!daemon_parse(line, &tmpl))
+        {
+            fprintf(out, "ERROR invalid request\n");
+            fflush(out);
+            continue;
+        }
 
-        if (t2mi_plp_id != -1)
+        if (lnb.num_user_bands && tmpl.symbolrate_max_mhz > scr_symbolrate_max())
         {
-            j += sprintf(buf + j, " %d", t2mi_plp_id);
+            fprintf(out, "ERROR max symbol rate above %u MS/s\n", scr_symbolrate_max());
+            fflush(out);
+            continue;
+        }
 
-            j += sprintf(buf + j, " %d", t2mi_pid);
+        if (!daemon_slot_ready(tmpl.slot))
+        {
+            fprintf(out, "ERROR slot %d not available\n", tmpl.slot);
+            fflush(out);
+            continue;
         }
 
-        j += sprintf(buf + j, "\n");
+        tmpl.out = out;
+        job = jobs_push(&tmpl);
+        if (job == NULL)
+        {
+            fprintf(out, "ERROR out of memory\n");
+            fflush(out);
+            continue;
+        }
 
-        fprintf(stdout, "%s", buf);
-        fflush(stdout);
+        jobs_wait(job);
+        daemon_end(out);
     }
+
+    free(line);
+    fclose(in);
+    fclose(out);
+
+    return NULL;
 }
 
-static int nim_sockets(void)
+static void *daemon_worker_main(void *arg)
 {
-    FILE *fp;
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t n;
-    int ids[4] = {-1, -1, -1, -1};
-    int *id;
-    int fe_id = -1;
+    struct scan_thread *t = arg;
 
-    fp = fopen("/proc/bus/nim_sockets", "r");
-    if (fp == NULL)
-        return fe_id;
+    blindscan_worker(&t->session, true);
 
-    while ((n = getline(&line, &len, fp)) != -1)
+    return NULL;
+}
+
+/*
+ * Start workers for blindscan capable slots of topo that have none yet. Workers
+ * whose slot disappeared are retired, so requests for it are refused until the
+ * same frontend shows up again.
+ */
+static void daemon_update(const struct nim_topology *topo)
+{
+    struct scan_thread **list;
+    struct scan_thread *t;
+
+    pthread_mutex_lock(&daemon_lock);
+
+    for (int i = 0; i < num_daemon_threads; i++)
     {
-        int val;
+        const struct nim_slot *nim = nim_find(topo, daemon_threads[i]->slot);
 
-        if (strstr(line, "NIM Socket") == line)
+        if (nim == NULL || nim->fe_id != daemon_threads[i]->session.fe_id)
+            daemon_threads[i]->fe_id = -1;
+        else
+            daemon_threads[i]->fe_id = nim->fe_id;
+    }
+
+    for (int i = 0; i < topo->num; i++)
+    {
+        const struct nim_slot *nim = &topo->slots[i];
+        bool running = false;
+
+        for (int j = 0; j < num_daemon_threads && !running; j++)
+            running = daemon_threads[j]->slot == nim->slot;
+
+        if (running || !nim->blindscan)
+            continue;
+
+        list = realloc(daemon_threads, (num_daemon_threads + 1) * sizeof(*daemon_threads));
+        if (list == NULL)
+            break;
+
+        daemon_threads = list;
+
+        t = calloc(1, sizeof(*t));
+        if (t == NULL)
+            break;
+
+        if (bs_session_open(&t->session, nim->fe_id, nim->slot) < 0)
         {
-            sscanf(line, "NIM Socket %d", &val);
-            id = &ids[val];
+            free(t);
+            continue;
         }
-        else if (strstr(line, "\tFrontend_Device") == line)
+
+        t->slot = nim->slot;
+        t->fe_id = nim->fe_id;
+        if (pthread_create(&t->thread, NULL, daemon_worker_main, t))
         {
-            sscanf(line, "\tFrontend_Device: %d", &val);
-            *id = val;
+            bs_session_close(&t->session);
+            free(t);
+            continue;
         }
+
+        daemon_threads[num_daemon_threads++] = t;
     }
 
-    fclose(fp);
-    if (line)
-        free(line);
+    pthread_mutex_unlock(&daemon_lock);
+}
+
+/*
+ * procfs does not report inotify events, so watch the DVB device nodes the
+ * frontends come and go with and reread /proc/bus/nim_sockets on change.
+ */
+static int daemon_watch(void)
+{
+    int fd;
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    inotify_add_watch(fd, "/dev/dvb", IN_CREATE | IN_DELETE);
+    inotify_add_watch(fd, "/dev/dvb/adapter0", IN_CREATE | IN_DELETE);
+
+    return fd;
+}
+
+/*
+ * Keep a session open on every frontend and serve scan jobs from clients of
+ * the UNIX socket at daemon_path. Each client request is queued for the
+ * frontend of its slot; results are streamed back followed by an END line
+ * (a zero length record in binary format).
+ */
+static int daemon_run(struct nim_topology *topo)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    struct pollfd pfd[2];
+    char events[4096];
+    pthread_t client;
+    int fd, conn;
+
+    if (strlen(daemon_path) >= sizeof(addr.sun_path))
+        return -1;
+
+    strcpy(addr.sun_path, daemon_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    unlink(daemon_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 8))
+    {
+        close(fd);
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    daemon_update(topo);
 
-    for (int i = 0; i < 4; i++)
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = daemon_watch();
+    pfd[1].events = POLLIN;
+
+    while (!signal_status)
     {
-        if (ids[i] == slot)
+        if (poll(pfd, 2, DAEMON_POLL_MS) <= 0)
+            continue;
+
+        if (pfd[1].revents & POLLIN)
         {
-            fe_id = ids[i];
-            break;
+            while (read(pfd[1].fd, events, sizeof(events)) > 0)
+                ;
+
+            nim_free(topo);
+            if (nim_load(topo) == 0)
+                daemon_update(topo);
+        }
+
+        if (!(pfd[0].revents & POLLIN))
+            continue;
+
+        conn = accept(fd, NULL, NULL);
+        if (conn < 0)
+            continue;
+
+        if (pthread_create(&client, NULL, daemon_client_main, (void *)(intptr_t)conn))
+        {
+            close(conn);
+            continue;
         }
+
+        pthread_detach(client);
+    }
+
+    pthread_mutex_lock(&jobs_lock);
+    pthread_cond_broadcast(&jobs_cond);
+    pthread_mutex_unlock(&jobs_lock);
+
+    for (int i = 0; i < num_daemon_threads; i++)
+    {
+        pthread_join(daemon_threads[i]->thread, NULL);
+        bs_session_close(&daemon_threads[i]->session);
+        free(daemon_threads[i]);
     }
 
-    return fe_id;
+    free(daemon_threads);
+
+    if (pfd[1].fd >= 0)
+        close(pfd[1].fd);
+    close(fd);
+    unlink(daemon_path);
+
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
-    int fd;
-    char str[10];
-    int fe_id;
+    struct nim_topology topo;
+    const struct nim_slot *nim;
+    struct sigaction sa;
+    int verify_fe;
 
+    output = stdout;
     handle_args(argc, argv);
 
-    fd = open("/var/run/blindscan.pid", O_RDWR | O_CREAT, 0664);
-    if (fd < 0)
-        exit(EXIT_FAILURE);
+    stats_start_us = now_us();
 
-    if (flock(fd, LOCK_EX | LOCK_NB))
-        exit(EXIT_FAILURE);
+    backend = &procfs_backend;
+    if (mock_source)
+    {
+        for (int i = 0; i < NIM_SLOTS_MAX; i++)
+            pthread_mutex_init(&mock_bus_lock[i], NULL);
 
-    sprintf(str, "%d\n", getpid());
-    if (write(fd, str, strlen(str)) == -1)
-        exit(EXIT_FAILURE);
+        backend = &mock_backend;
+        if (!strncmp(mock_source, "synthetic:", 10))
+            get_int_arg(&mock_records, mock_source + 10);
+        else if (mock_load_trace(mock_source) < 0)
+            exit(EXIT_FAILURE);
+    }
+
+    if (lnb.type == LNB_WIDEBAND && !range_set)
+    {
+        start_frequency_mhz = 290;
+        stop_frequency_mhz = 2340;
+    }
+
+    if (lnb.num_user_bands && symbolrate_max_mhz > scr_symbolrate_max())
+    {
+        if (symbolrate_max_set)
+        {
+            fprintf(stderr, "ERROR max symbol rate %u MS/s does not fit the user band, at most %u MS/s\n",
+                    symbolrate_max_mhz, scr_symbolrate_max());
+            exit(EXIT_FAILURE);
+        }
+
+        fprintf(stderr, "WARNING max symbol rate limited to %u MS/s by the user band width\n",
+                scr_symbolrate_max());
+        symbolrate_max_mhz = scr_symbolrate_max();
+    }
 
-    signal(SIGINT, signal_handler);
+    if (output_path)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        output = output_open(output_path);
+        if (output == NULL)
+            exit(EXIT_FAILURE);
+    }
 
-    sleep(5);
+    if (record_path)
+    {
+        record_fp = fopen(record_path, "w");
+        if (record_fp == NULL)
+            exit(EXIT_FAILURE);
+    }
 
-    fe_id = nim_sockets();
-    if (fe_id != -1)
-        blindscan(fe_id);
+    if (plan)
+    {
+        if (!get_plan_arg(plan, DISEQC_NONE))
+            exit(EXIT_FAILURE);
+    }
 
-    flock(fd, LOCK_UN);
-    close(fd);
+    if (campaign)
+    {
+        if (campaign_load(campaign) < 0)
+            exit(EXIT_FAILURE);
+    }
+
+    if (resume)
+    {
+        if (checkpoint_path == NULL || checkpoint_load(checkpoint_path) < 0)
+            exit(EXIT_FAILURE);
+    }
+
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    if (daemon_path)
+    {
+        /* Daemon clients are answered while their scan runs. */
+        merge = false;
+        verify_slot = -1;
+        checkpoint_path = NULL;
+        if (nim_load(&topo) < 0 || daemon_run(&topo) < 0)
+            exit(EXIT_FAILURE);
+        nim_free(&topo);
+    }
+    else if (bench_tuners && nim_load(&topo) == 0)
+    {
+        /* Every round has to scan the same spectrum from scratch. */
+        merge = false;
+        verify_slot = -1;
+        cache_dir = NULL;
+        checkpoint_path = NULL;
+        blindscan_bench(&topo);
+        nim_free(&topo);
+    }
+    else if (nim_load(&topo) == 0)
+    {
+        if (verify_slot >= 0)
+        {
+            nim = nim_find(&topo, verify_slot);
+            if (nim == NULL || (!all_slots && !num_slots && nim == nim_find(&topo, slot)))
+                exit(EXIT_FAILURE);
+
+            verify_fe = nim->fe_id;
+            if (verify_start(&verify_fe) < 0)
+                exit(EXIT_FAILURE);
+        }
+
+        if (all_slots || num_slots)
+        {
+            tag_slots = true;
+            blindscan_parallel(&topo);
+        }
+        else
+        {
+            if (plan == NULL && campaign == NULL)
+                jobs_add(slot, vertical, default_band());
+
+            jobs_split(split_mhz);
+
+            nim = nim_find(&topo, slot);
+            if (nim && blindscan(nim->fe_id, nim->slot) < 0)
+                exit(EXIT_FAILURE);
+        }
+
+        nim_free(&topo);
+    }
+
+    merged_flush();
+    verify_finish();
+    if (output != stdout)
+        fclose(output);
+    stats_report();
+
+    if (record_fp)
+        fclose(record_fp);
+
+    jobs_free();
+    checkpoint_free();
+    free(merged.e);
 
     return 0;
 }